@@ -0,0 +1,38 @@
+#!/bin/sh
+# Measure the overhead of cppipe on a cache hit
+# compared to running the cached binary directly
+# Usage: bench/launcher.sh [RUNS]
+set -e
+
+RUNS=${1:-1000}
+
+tmp=$(mktemp -d)
+trap 'rm -r "$tmp"' EXIT
+
+printf 'int main() { return 0; }\n' > "$tmp/empty.c"
+cppipe -n "$tmp/empty.c"	# warm the cache
+
+cache=${XDG_CACHE_HOME:-$HOME/.cache}/cppipe
+bin=$(sed -n 's/^bin //p' "$cache"/*"$tmp/empty.c.stamp")
+
+# Print the mean time of a run in microseconds
+time_runs()
+{
+	begin=$(date +%s%N)
+	i=0
+	while [ $i -lt $RUNS ]
+	do
+		"$@"
+		i=$((i + 1))
+	done
+	end=$(date +%s%N)
+	echo $(( (end - begin) / RUNS / 1000 ))
+}
+
+direct=$(time_runs "$bin")
+launcher=$(time_runs cppipe "$tmp/empty.c")
+
+echo "runs:     $RUNS"
+echo "direct:   $direct us"
+echo "cppipe:   $launcher us"
+echo "overhead: $((launcher - direct)) us"
@@ -16,8 +16,23 @@ const char* CXX = "c++";
 // -O2 seems to work best for both execution and compilation speed
 #define RELEASE_FLAGS "-O2", "-s"
 
+// ...for the first, quick build of tiered compilation (-t)
+// the RELEASE_FLAGS build replaces it in the background
+#define TIER0_FLAGS "-O0", "-s"
+
+// ...for profile guided optimization (--pgo), these are for gcc
+// The first build collects a profile over PGO_TRAINING_RUNS runs
+#define PGO_GENERATE_FLAGS "-fprofile-generate", "-fprofile-update=prefer-atomic"
+// Then it is replaced by a build that uses the profile, add "-flto" to also optimize at link time
+#define PGO_USE_FLAGS "-fprofile-use", "-fprofile-partial-training", "-Wno-missing-profile"
+#define PGO_TRAINING_RUNS 10
+
+// ...to pick the instructions of the CPU, the cache keeps a binary for each kind of CPU
+// --export leaves it out unless --march is given, so exported binaries run anywhere
+#define MARCH_FLAG "-march=native"
+
 // ...for both C and C++
-#define CPPFLAGS  "-fwhole-program", "-march=native", "-Wall", "-Wextra", "-pipe"
+#define CPPFLAGS  "-fwhole-program", "-Wall", "-Wextra", "-pipe"
 
 // ...for C
 #define CFLAGS CPPFLAGS
@@ -26,3 +41,17 @@ const char* CXX = "c++";
 // cppipe command functions use C++17
 // Wparentheses is disabled on C++ because of the cppipe functions
 #define CXXFLAGS CPPFLAGS, "-std=c++17", "-Wno-parentheses"
+
+// ...for --export --static and --export --lto
+#define EXPORT_STATIC_FLAGS "-static"
+#define EXPORT_LTO_FLAGS "-flto=auto"
+
+// ...for --shared, the shared objects loaded by call()
+#define SHARED_FLAGS "-shared", "-fPIC"
+
+// Limits of the binary cache, the least recently used binaries beyond them
+// are removed by "cppipe --gc" and by a daily cleanup after a compile
+// Maximum size in MiB, 0 for no limit, overridden by $CPPIPE_CACHE_MAX_SIZE
+#define CACHE_MAX_SIZE_MB 1024
+// Remove binaries unused for this many days, 0 for no limit, overridden by $CPPIPE_CACHE_MAX_AGE
+#define CACHE_MAX_AGE_DAYS 30
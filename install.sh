@@ -8,13 +8,19 @@ PREFIX=/usr/local
 # Compile cppipe
 options="-std=c++17 -Ofast -fwhole-program -march=native -DNDEBUG -Wall -Wextra -Wno-parentheses -Wno-unused-result -s -pipe"
 # options="-std=c++17 -g"
-c++ -o cppipe $options cppipe.cpp
+# Link statically when libc allows it, it saves the dynamic loader's work on every run
+if echo 'int main(){}' | c++ -static -xc++ -o /dev/null - 2>/dev/null
+then
+    c++ -o cppipe $options -static cppipe.cpp
+else
+    c++ -o cppipe $options cppipe.cpp
+fi
 chmod 755 cppipe
 mv cppipe ${PREFIX}/bin
 
 # Install headers
 mkdir -p -m755 ${PREFIX}/include/cppipe
-cp basicTypes.h commands.hpp commands.inl childProcess.hpp childProcess.inl ${PREFIX}/include/cppipe
+cp basicTypes.h commands.hpp commands.inl childProcess.hpp childProcess.inl trace.hpp trace.inl cache.hpp cache.inl memo.hpp memo.inl taskGraph.hpp taskGraph.inl call.hpp call.inl files.hpp files.inl ring.hpp ring.inl ${PREFIX}/include/cppipe
 chmod 644 ${PREFIX}/include/cppipe/*
 
 # Clear old cache
@@ -3,7 +3,7 @@ set -e
 
 # Test cppipe functions
 OKs=$(test/functions_test.cppipe | grep OK | wc -l)
-EXPECTED=14
+EXPECTED=25
 if ! [ $OKs = $EXPECTED ]
 then
     echo "Functions test failed: EXPECTED $EXPECTED OKs, got $OKs"
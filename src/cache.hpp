@@ -0,0 +1,138 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
+#include "basicTypes.h"
+
+/* Layout of the cppipe cache, shared by cppipe and the scripts it runs
+
+   CACHE_ROOT/.index/HASH    symlink to the stamp of a cache entry, HASH is of
+                             the absolute source path as given to cppipe and the
+                             index_key, which is cheaper to find than the KEY
+   CACHE_ROOT/KEY/SRC_DIR/FILE
+                             cached binary of the source SRC_DIR/FILE, KEY is the
+                             build_key of the machine it was compiled for
+   CACHE_ROOT/KEY/SRC_DIR/FILE.stamp
+                             what the binary was built from, see Stamp
+                             its mtime is when the binary was last used
+   CACHE_ROOT/memo/HASH      output of a memoized command, see memo.hpp
+   CACHE_ROOT/tasks/HASH     hash of the inputs of a by_hash task, see taskGraph.hpp
+
+   A cache shared by different machines e.g. on NFS keeps a binary for each
+   kind of CPU and compiler, so -march=native builds never run on a CPU
+   that lacks the instructions they use
+*/
+
+namespace _cppipe
+{
+	enum : U64 { FNV_BASIS = 14695981039346656037ull };
+
+	/* 64 bit FNV-1a hash, can be chained by passing the previous hash */
+	U64 hash_bytes(const void* data, size_t len, U64 hash = FNV_BASIS);
+	U64 hash_bytes(std::string_view, U64 hash = FNV_BASIS);
+
+	/* Fixed width lowercase hex */
+	std::string to_hex(U64);
+
+	/* $XDG_CACHE_HOME/cppipe, ~/.cache/cppipe or /var/cache/cppipe */
+	std::string cache_root();
+
+	/* Write a temporary file and rename it over path, so readers never see it half written
+	 * The missing directories of path are created */
+	bool write_atomically(const std::string& path, std::string_view content);
+
+	/* Hash of the CPU model and its instruction set extensions */
+	U64 cpu_fingerprint();
+
+	/* The file of a compiler, searched in PATH like execvp if it has no '/'
+	 * st is filled with its stat, empty if it isn't found */
+	std::string find_compiler(const char* compiler, struct stat& st);
+
+	/* Hash of the identity of a compiler, the one found in PATH if it has no '/'
+	 * Changes when it is upgraded, 0 if it isn't found */
+	U64 compiler_fingerprint(const char* compiler);
+
+	/* Directory of the cache for the builds by compiler on this machine */
+	std::string build_key(const char* compiler);
+
+	/* Key of the index for the builds by compiler on this machine, unlike build_key
+	 * it doesn't search PATH, the compiler is a dependency in the stamp instead */
+	std::string index_key(const char* compiler);
+
+	/* Index file for a source path as it was found by cppipe
+	 * variant separates builds of the same source e.g. debug ones */
+	std::string index_path(const std::string& root, std::string_view abs_src, std::string_view variant);
+
+	/* A file a cached binary was built from */
+	struct Dependency
+	{
+		std::string path;
+		I64 mtime_ns;
+		I64 size;
+		U64 ino;
+
+		/* Whether the file is still the same as the stat result */
+		bool matches(const struct stat&) const;
+	};
+
+	/* Fill a Dependency from the current state of a file, false if it doesn't exist */
+	bool stat_dependency(const char* path, Dependency&);
+
+	/* What kind of build a cached binary is */
+	enum Tier
+	{
+		TIER_QUICK,		/* unoptimized, replaced in the background */
+		TIER_OPTIMIZED,
+		TIER_PGO_TRAINING,	/* collects a profile for the next build */
+		TIER_PGO_OPTIMIZED	/* optimized with the profile */
+	};
+
+	/* Seconds between updates of the last use time of a stamp */
+	enum : I64 { USE_RESOLUTION = 60 * 60 };
+
+	/* Record of a cache entry, written by cppipe every time it makes sure
+	 * the cached binary is up to date
+	 *
+	 * Stored as "key value" lines:
+	 *     bin PATH
+	 *     hash HASH
+	 *     tier TIER
+	 *     file PATH
+	 *     dep MTIME_NS SIZE INODE PATH
+	 *     cwd PATH
+	 */
+	struct Stamp
+	{
+		std::string bin;	       /* the cached binary */
+		U64 hash = 0;		       /* of the preprocessed source */
+		int tier = TIER_OPTIMIZED;     /* a Tier */
+		std::vector<std::string> files; /* other files of the entry e.g. the .ii */
+		std::vector<Dependency> deps;  /* deps[0] is the source file */
+		std::string cwd;	       /* if a dep was found relative to it, else empty */
+		I64 used = 0;		       /* when it was last used, set by read */
+
+		/* false if the file is missing or malformed */
+		bool read(const char* path);
+		/* Replace the file atomically */
+		bool write(const char* path) const;
+
+		/* Whether no dependency has changed since the stamp was written
+		 * and the includes found relative to cwd would be found again from here
+		 * src_stat is the stat of the source if already known,
+		 * only_src skips the checks of included files */
+		bool fresh(const struct stat* src_stat = nullptr, bool only_src = false) const;
+
+		/* Update the last use time of the stamp at path,
+		 * at most every USE_RESOLUTION seconds to spare the writes */
+		void mark_used(const char* path) const;
+	};
+
+	/* Files that are included by a preprocessed source, taken from its line markers
+	 * System headers are put in system_headers if given, else listed too */
+	std::vector<std::string> included_files(std::string_view preprocessed,
+	                                        std::vector<std::string>* system_headers = nullptr);
+}
+
+#include "cache.inl"
@@ -0,0 +1,369 @@
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#include "cache.hpp"
+
+namespace _cppipe
+{
+	inline U64 hash_bytes(const void* data, size_t len, U64 hash)
+	{
+		const U8* p = (const U8*)data;
+		for(size_t i = 0; i < len; ++i)
+		{
+			hash ^= p[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	inline U64 hash_bytes(std::string_view s, U64 hash)
+	{
+		return hash_bytes(s.data(), s.size(), hash);
+	}
+
+	inline std::string to_hex(U64 n)
+	{
+		char buf[17];
+		snprintf(buf, sizeof buf, "%016llx", (unsigned long long)n);
+		return buf;
+	}
+
+	inline std::string cache_root()
+	{
+		std::string root;
+		if(const char* XDG_CACHE = getenv("XDG_CACHE_HOME"))
+		{
+			root = XDG_CACHE;
+			root += "/cppipe";
+		}
+		else if(const char* HOME = getenv("HOME"))
+		{
+			root = HOME;
+			root += "/.cache/cppipe";
+		}
+		else
+		{
+			root = "/var/cache/cppipe";
+		}
+		return root;
+	}
+
+	inline bool write_atomically(const std::string& path, std::string_view content)
+	{
+		for(size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+			mkdir(path.substr(0, slash).c_str(), 0755);
+
+		std::string tmp = path + ".tmp" + std::to_string(getpid());
+		fd_t fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if(fd == -1)
+			return false;
+		bool ok = ::write(fd, content.data(), content.size()) == (ssize_t)content.size();
+		close(fd);
+
+		if(!ok || rename(tmp.c_str(), path.c_str()) == -1)
+		{
+			unlink(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	inline U64 cpu_fingerprint()
+	{
+		U64 hash = FNV_BASIS;
+#if defined(__x86_64__) || defined(__i386__)
+		unsigned a, b, c, d;
+		if(__get_cpuid(0, &a, &b, &c, &d))	/* vendor */
+		{
+			unsigned regs[] = { b, c, d };
+			hash = hash_bytes(regs, sizeof regs, hash);
+		}
+		if(__get_cpuid(1, &a, &b, &c, &d))
+		{
+			/* family and model without the stepping,
+			 * b is left out, it has the id of the core we run on */
+			unsigned regs[] = { a & ~0xfu, c, d };
+			hash = hash_bytes(regs, sizeof regs, hash);
+		}
+		if(__get_cpuid_count(7, 0, &a, &b, &c, &d))	/* AVX2, AVX-512... */
+		{
+			unsigned regs[] = { b, c, d };
+			hash = hash_bytes(regs, sizeof regs, hash);
+		}
+		if(__get_cpuid(0x80000001, &a, &b, &c, &d))
+		{
+			unsigned regs[] = { c, d };
+			hash = hash_bytes(regs, sizeof regs, hash);
+		}
+#elif defined(__linux__)
+		unsigned long caps[] = { getauxval(AT_HWCAP), getauxval(AT_HWCAP2) };
+		hash = hash_bytes(caps, sizeof caps, hash);
+		if(const char* platform = (const char*)getauxval(AT_PLATFORM))
+			hash = hash_bytes(platform, hash);
+#endif
+		return hash;
+	}
+
+	inline std::string find_compiler(const char* compiler, struct stat& st)
+	{
+		std::string path = compiler;
+		bool found = false;
+		const char* PATH = getenv("PATH");
+		if(strchr(compiler, '/') || !PATH)
+		{
+			found = stat(compiler, &st) == 0;
+		}
+		else
+		{
+			for(const char* dir = PATH; !found; ++dir)
+			{
+				const char* end = strchrnul(dir, ':');
+				path.assign(dir, end - dir);
+				path += '/';
+				path += compiler;
+				found = stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+				dir = end;
+				if(!*end)
+					break;
+			}
+		}
+		if(!found)
+			path.clear();
+		return path;
+	}
+
+	inline U64 compiler_fingerprint(const char* compiler)
+	{
+		struct stat st;
+		if(find_compiler(compiler, st).empty())
+			return 0;
+
+		/* The binary after the symlinks, a new version is a new file */
+		I64 id[] = { (I64)st.st_dev, (I64)st.st_ino, st.st_size,
+		             (I64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec };
+		return hash_bytes(id, sizeof id);
+	}
+
+	inline std::string build_key(const char* compiler)
+	{
+		U64 cpu = cpu_fingerprint();
+		return to_hex(hash_bytes(&cpu, sizeof cpu, compiler_fingerprint(compiler)));
+	}
+
+	inline std::string index_key(const char* compiler)
+	{
+		/* The same name in the same PATH finds the same compiler */
+		U64 hash = cpu_fingerprint();
+		hash = hash_bytes(&hash, sizeof hash);
+		hash = hash_bytes(compiler, strlen(compiler) + 1, hash);
+		if(const char* PATH = getenv("PATH"))
+			hash = hash_bytes(std::string_view(PATH), hash);
+		return to_hex(hash);
+	}
+
+	inline std::string index_path(const std::string& root, std::string_view abs_src, std::string_view variant)
+	{
+		U64 hash = hash_bytes(abs_src);
+		hash = hash_bytes("", 1, hash);	 /* separator */
+		hash = hash_bytes(variant, hash);
+		return root + "/.index/" + to_hex(hash);
+	}
+
+	inline bool Dependency::matches(const struct stat& st) const
+	{
+		return (I64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec == mtime_ns
+			&& st.st_size == size
+			&& st.st_ino == ino;
+	}
+
+	inline bool stat_dependency(const char* path, Dependency& dep)
+	{
+		struct stat st;
+		if(stat(path, &st) == -1)
+			return false;
+
+		dep.path = path;
+		dep.mtime_ns = (I64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+		dep.size = st.st_size;
+		dep.ino = st.st_ino;
+		return true;
+	}
+
+	inline bool Stamp::read(const char* path)
+	{
+		fd_t fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd == -1)
+			return false;
+
+		struct stat st;
+		if(fstat(fd, &st) == -1)
+		{
+			close(fd);
+			return false;
+		}
+		used = st.st_mtime;
+
+		std::string text;
+		char buf[4096];
+		for(ssize_t n; (n = ::read(fd, buf, sizeof buf)) > 0; )
+			text.append(buf, n);
+		close(fd);
+
+		bin.clear();
+		hash = 0;
+		tier = TIER_OPTIMIZED;
+		files.clear();
+		deps.clear();
+		cwd.clear();
+
+		const char* p = text.c_str();
+		while(*p)
+		{
+			const char* end = strchr(p, '\n');
+			if(!end)
+				return false;	/* truncated */
+
+			if(!strncmp(p, "bin ", 4))
+			{
+				bin.assign(p + 4, end - p - 4);
+			}
+			else if(!strncmp(p, "hash ", 5))
+			{
+				hash = strtoull(p + 5, nullptr, 16);
+			}
+			else if(!strncmp(p, "tier ", 5))
+			{
+				tier = atoi(p + 5);
+			}
+			else if(!strncmp(p, "file ", 5))
+			{
+				files.emplace_back(p + 5, end - p - 5);
+			}
+			else if(!strncmp(p, "dep ", 4))
+			{
+				Dependency dep;
+				char* field;
+				dep.mtime_ns = strtoll(p + 4, &field, 10);
+				dep.size = strtoll(field, &field, 10);
+				dep.ino = strtoull(field, &field, 10);
+				if(*field != ' ')
+					return false;
+				dep.path.assign(field + 1, end - field - 1);
+				deps.push_back(std::move(dep));
+			}
+			else if(!strncmp(p, "cwd ", 4))
+			{
+				cwd.assign(p + 4, end - p - 4);
+			}
+			/* unknown keys are skipped */
+
+			p = end + 1;
+		}
+
+		return !bin.empty() && !deps.empty();
+	}
+
+	inline bool Stamp::write(const char* path) const
+	{
+		std::string text = "bin " + bin + '\n'
+			+ "hash " + to_hex(hash) + '\n'
+			+ "tier " + std::to_string(tier) + '\n';
+		for(const std::string& file: files)
+			text += "file " + file + '\n';
+		for(const Dependency& dep: deps)
+		{
+			text += "dep " + std::to_string(dep.mtime_ns) + ' ' + std::to_string(dep.size)
+				+ ' ' + std::to_string(dep.ino) + ' ' + dep.path + '\n';
+		}
+		if(!cwd.empty())
+			text += "cwd " + cwd + '\n';
+
+		/* Readers never see a partial stamp */
+		return write_atomically(path, text);
+	}
+
+	inline bool Stamp::fresh(const struct stat* src_stat, bool only_src) const
+	{
+		struct stat st;
+		if(!src_stat)
+		{
+			if(stat(deps[0].path.c_str(), &st) == -1)
+				return false;
+			src_stat = &st;
+		}
+		if(!deps[0].matches(*src_stat))
+			return false;
+
+		if(only_src)
+			return true;
+
+		/* Run from elsewhere, "file.h" may be another file */
+		if(!cwd.empty())
+		{
+			char here[PATH_MAX];
+			if(!getcwd(here, sizeof here) || cwd != here)
+				return false;
+		}
+
+		for(size_t i = 1; i < deps.size(); ++i)
+		{
+			if(stat(deps[i].path.c_str(), &st) == -1 || !deps[i].matches(st))
+				return false;
+		}
+		return true;
+	}
+
+	inline void Stamp::mark_used(const char* path) const
+	{
+		if(time(nullptr) - used >= USE_RESOLUTION)
+			utimensat(AT_FDCWD, path, nullptr, 0);
+	}
+
+	inline std::vector<std::string> included_files(std::string_view pp, std::vector<std::string>* system_headers)
+	{
+		std::vector<std::string> files;
+
+		/* Line markers look like: # LINE "FILE" FLAGS
+		 * flag 1 means entering the file, 3 that it is a system header */
+		for(size_t begin = 0, end; begin < pp.size(); begin = end + 1)
+		{
+			end = pp.find('\n', begin);
+			if(end == std::string_view::npos)
+				end = pp.size();
+
+			std::string_view line = pp.substr(begin, end - begin);
+			if(line.size() < 4 || line[0] != '#' || line[1] != ' ' || line[2] < '0' || line[2] > '9')
+				continue;
+
+			size_t open_quote = line.find('"');
+			size_t close_quote = line.rfind('"');
+			if(open_quote == std::string_view::npos || close_quote == open_quote)
+				continue;
+
+			std::string_view file = line.substr(open_quote + 1, close_quote - open_quote - 1);
+			std::string_view flags = line.substr(close_quote + 1);
+			if(file.empty() || file[0] == '<'	/* <stdin>, <built-in> ... */
+			   || flags.find(" 1") == std::string_view::npos)
+				continue;
+
+			std::vector<std::string>& list = system_headers && flags.find(" 3") != std::string_view::npos
+				? *system_headers : files;
+			bool known = false;
+			for(const std::string& f: list)
+				known = known || f == file;
+			if(!known)
+				list.emplace_back(file);
+		}
+
+		return files;
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "commands.hpp"
+#include "cache.hpp"
+
+/* Calling other scripts in-process
+
+   A script is built by "cppipe --shared" into a cached shared object, which is
+   loaded with dlopen and its main called, without starting a process.
+   Like running it with cppipe, it is rebuilt when it or its headers change,
+   after the first call that is checked with a stat of each file.
+
+   shell:   other.cpp ARG > out.txt
+   becomes: call("other.cpp", { "ARG" }, 0, open("out.txt", ...));
+
+   The called script shares the process: exit() in it exits the caller too,
+   its global variables keep their values between calls.
+   On glibc older than 2.34 link with -ldl: // cppipe: link=dl
+*/
+
+/* Call the main of the script with the args after argv[0], with its stdin, stdout and stderr
+ * redirected to the given fds, return what main returns or 127 if the script can't be built or loaded */
+int call(const char* script, const std::vector<const char*>& args = {}, fd_t in = 0, fd_t out = 1, fd_t err = 2);
+
+namespace _cppipe
+{
+	/* A script loaded by call() */
+	struct LoadedScript
+	{
+		Stamp stamp;		/* of the shared object, stamp.bin is its path */
+		void* handle = nullptr;
+		int (*main)(int, char**) = nullptr;
+	};
+
+	/* Build the script with cppipe if needed and load it, false if that fails */
+	bool load_script(const char* script, LoadedScript&);
+}
+
+#include "call.inl"
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "call.hpp"
+#include "trace.hpp"
+
+namespace _cppipe
+{
+	/* By the script path as given to call() */
+	inline std::unordered_map<std::string, LoadedScript> loaded_scripts_;
+
+	inline bool load_script(const char* script, LoadedScript& s)
+	{
+		/* The fast path of cppipe without the exec */
+		if(s.handle && s.stamp.fresh())
+			return true;
+
+		if(s.handle)
+		{
+			dlclose(s.handle);
+			s.handle = nullptr;
+		}
+
+		/* cppipe finds the script, builds it under the lock of its cache entry and prints the path */
+		Proc p = detachRedirOut(Cmd("cppipe", "--shared", script));
+		std::string so = read_to_end(p.out);	/* closes p.out */
+		if(!wait(p))
+			return false;
+		while(!so.empty() && so.back() == '\n')
+			so.pop_back();
+
+		if(!s.stamp.read((so + ".stamp").c_str()))
+		{
+			std::cerr << "Can't read the stamp of: " << so << '\n';
+			return false;
+		}
+
+		/* dlopen reuses an object loaded by the same path, and dlclose can't unload one with
+		   unique symbols e.g. inline variables of C++, so each load gets a path of its own */
+		static unsigned loads = 0;
+		const std::string path = so + ".tmp" + std::to_string(getpid()) + '.' + std::to_string(++loads);
+		const bool linked = link(so.c_str(), path.c_str()) == 0;
+		s.handle = dlopen(linked ? path.c_str() : so.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if(linked)
+			unlink(path.c_str());
+		if(!s.handle)
+		{
+			std::cerr << "Can't load: " << dlerror() << '\n';
+			return false;
+		}
+
+		s.main = (int (*)(int, char**))dlsym(s.handle, "main");
+		if(!s.main)
+		{
+			std::cerr << "No main in: " << so << '\n';
+			dlclose(s.handle);
+			s.handle = nullptr;
+			return false;
+		}
+		return true;
+	}
+}
+
+inline int call(const char* script, const std::vector<const char*>& args, fd_t in, fd_t out, fd_t err)
+{
+	using namespace _cppipe;
+
+	TraceSpan span("call");
+	if(tracing())
+		span.args.add("script", script);
+
+	LoadedScript& s = loaded_scripts_[script];
+	if(!load_script(script, s))
+		return 127;
+
+	std::vector<char*> argv{ (char*)script };
+	for(const char* arg: args)
+		argv.push_back((char*)arg);
+	argv.push_back(nullptr);
+
+	/* What was buffered goes to our own stdio */
+	std::cout.flush();
+	fflush(nullptr);
+
+	const fd_t fds[3] = { in, out, err };
+	fd_t saved[3] = { -1, -1, -1 };
+	for(fd_t i = 0; i < 3; ++i)
+	{
+		if(fds[i] == i)
+			continue;
+		saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+		dup2(fds[i], i);
+	}
+
+	/* getopt starts over for the new argv */
+	optind = 0;
+	const int status = s.main(argv.size() - 1, argv.data());
+
+	std::cout.flush();
+	fflush(nullptr);
+	clearerr(stdin);
+
+	for(fd_t i = 0; i < 3; ++i)
+	{
+		if(saved[i] == -1)
+			continue;
+		dup2(saved[i], i);
+		close(saved[i]);
+	}
+	optind = 0;
+
+	return status;
+}
@@ -2,6 +2,9 @@
 
 #include "basicTypes.h"
 #include <optional>
+#include <vector>
+#include <utility>
+#include <sys/resource.h>
 
 struct Proc
 {
@@ -9,6 +12,9 @@ struct Proc
 	fd_t in;
 	fd_t out;
 	fd_t err;
+	/* Rings offered with the in and out pipes of a ring() command, see ring.hpp */
+	fd_t in_ring = -1;
+	fd_t out_ring = -1;
 };
 
 /* process that has finished for any reason */
@@ -23,14 +29,36 @@ struct DeadProc: public Proc
 	explicit operator bool();
 };
 
-/* Wait for a running proccess to finish */
+/* Wait for a running proccess to finish
+ * With SIGCHLD ignored the system reaps it and its exit status is lost, it counts as a success */
 DeadProc wait(Proc);
 
-/* Check if the Proc has exited and return it's DeadProc if it has */
+/* Check if the Proc has exited and return it's DeadProc if it has, like wait if reaped already */
 std::optional<DeadProc> check_exited(Proc);
 
 enum { PIPE = -1 };
 
+/* IO scheduling classes, like ionice -c */
+enum IoClass
+{
+	IO_REALTIME = 1,
+	IO_BEST_EFFORT = 2,
+	IO_IDLE = 3
+};
+
+/* How to run a process, applied in the child between fork and exec */
+struct ExecAttrs
+{
+	std::vector<int> cpus;		/* CPUs to run on, empty for all */
+	int nice = 0;			/* added to the niceness */
+	int io_class = 0;		/* an IoClass, 0 to keep it */
+	int io_level = 0;		/* 0-7, 0 is the highest priority */
+	std::vector<std::pair<int, rlim_t>> limits; /* resource, limit for setrlimit */
+	const char* cgroup = nullptr;	/* cgroup v2 directory to move to, if writable */
+	bool ring = false;		/* offer rings with the in and out pipes, see ring.hpp */
+	fd_t in_ring = -1;		/* ring offered with an in that is not a PIPE, set by operator| */
+};
+
 /* Create a proccess
  * argv is an array of command parameters
  * argv[0] is the command itself, argv needs to end with nullptr
@@ -38,9 +66,13 @@ enum { PIPE = -1 };
  *
  * Can take FDs as arguments which will be used instead of std
  * If PIPE is given for any FD, a pipe is created and input/output/error is redirected there
- * The pipe can then be read (out, err) or written to (in)
+ * The pipe can then be read (out, err) or written to (in), it is O_CLOEXEC
+ * The process inherits the FDs without O_CLOEXEC like with the shell, the pipes and
+ * files of cppipe have it, so it never holds the pipes of other processes open
+ * With attrs->ring its rings are put at FDs 3 and 4, see ring.hpp
  */
-Proc createProcess(const char* const argv[], fd_t in=0, fd_t out=1, fd_t err=2);
+Proc createProcess(const char* const argv[], fd_t in=0, fd_t out=1, fd_t err=2,
+                   const ExecAttrs* attrs=nullptr);
 
 /* execvp the command or exit */
 void exec_or_die(const char* const argv[]);
@@ -1,9 +1,77 @@
 #include <iostream>
 #include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
+#include <vector>
+#include <utility>
+#include <algorithm>
 #include "childProcess.hpp"
+#include "ring.hpp"
+#include "trace.hpp"
+
+namespace _cppipe
+{
+	/* Names of traced processes that were not waited yet, to end their events */
+	inline std::vector<std::pair<pid_t, std::string>> traced_procs_;
+
+	inline void trace_spawn(const char* const argv[], const Proc& p)
+	{
+		TraceArgs args;
+		args.add("pid", p.pid).add("argv", argv)
+			.add("in", p.in).add("out", p.out).add("err", p.err);
+		trace_event(argv[0], 'b', now_us(), &args, p.pid);
+		traced_procs_.emplace_back(p.pid, argv[0]);
+	}
+
+	inline void trace_exit(pid_t pid, int status)
+	{
+		for(auto it = traced_procs_.begin(); it != traced_procs_.end(); ++it)
+		{
+			if(it->first != pid)
+				continue;
+
+			TraceArgs args;
+			if(WIFEXITED(status))
+				args.add("exit_status", WEXITSTATUS(status));
+			else
+				args.add("signal", WTERMSIG(status));
+			trace_event(it->second.c_str(), 'e', now_us(), &args, pid);
+			traced_procs_.erase(it);
+			break;
+		}
+	}
+
+	/* Processes nobody waits for e.g. the first commands of a detached pipeline,
+	   reaped when a process is created so they don't pile up as zombies */
+	inline std::vector<pid_t> unwaited_;
+
+	inline void wait_later(pid_t pid)
+	{
+		unwaited_.push_back(pid);
+	}
+
+	inline void reap_unwaited()
+	{
+		for(size_t i = 0; i < unwaited_.size(); )
+		{
+			int status;
+			pid_t rc = waitpid(unwaited_[i], &status, WNOHANG);
+			if(rc == 0)	/* still running */
+			{
+				++i;
+				continue;
+			}
+			if(rc > 0 && tracing())
+				trace_exit(rc, status);
+			unwaited_[i] = unwaited_.back();
+			unwaited_.pop_back();
+		}
+	}
+}
 
 
 inline DeadProc::DeadProc(Proc origin, int status)
@@ -20,11 +88,16 @@ inline DeadProc::operator bool()
 inline DeadProc wait(Proc p)
 {
 	int status;
-	if( waitpid(p.pid, &status, 0) == -1 )
+	pid_t rc = waitpid(p.pid, &status, 0);
+	if( rc == -1 && errno == ECHILD )	/* reaped by the system, SIGCHLD is ignored */
+		status = 0;
+	else if( rc == -1 )
 	{
 		std::cerr << "waitpid encountered an error: " << strerror(errno) << std::endl;
 		exit(1);
 	}
+	if(_cppipe::tracing())
+		_cppipe::trace_exit(p.pid, status);
 	return DeadProc(p, status);
 }
 
@@ -38,6 +111,10 @@ inline std::optional<DeadProc> check_exited(Proc p)
 	{
 		result = std::nullopt;
 	}
+	else if(rc == -1 && errno == ECHILD)	// reaped by the system, SIGCHLD is ignored
+	{
+		result = DeadProc(p, 0);
+	}
 	else if(rc == -1)	// waitpid error
 	{
 		std::cerr << "waitpid encountered an error: " << strerror(errno) << std::endl;
@@ -45,6 +122,8 @@ inline std::optional<DeadProc> check_exited(Proc p)
 	}
 	else			// finished
 	{
+		if(_cppipe::tracing())
+			_cppipe::trace_exit(p.pid, status);
 		result = DeadProc(p, status);
 	}
 
@@ -57,10 +136,70 @@ namespace _cppipe
 	{
 		if(new_fd != old_fd)
 			dup2(new_fd, old_fd);
+		else
+			fcntl(old_fd, F_SETFD, 0);	/* keep it across exec */
+	}
+
+	inline void die_in_child(const char* what, const char* const argv[])
+	{
+		std::cerr << "Can't " << what << " of: " << argv[0] << ' ' << strerror(errno) << '\n';
+		_exit(1);
+	}
+
+	/* Called in the child, a failure exits it */
+	inline void apply_attrs(const ExecAttrs& a, const char* const argv[])
+	{
+		/* First, so the limits of the cgroup apply to the rest */
+		if(a.cgroup)
+		{
+			std::string procs = a.cgroup;
+			procs += "/cgroup.procs";
+			fd_t fd = open(procs.c_str(), O_WRONLY | O_CLOEXEC);
+			if(fd != -1)
+			{
+				std::string pid = std::to_string(getpid());
+				write(fd, pid.data(), pid.size());
+				close(fd);
+			}
+		}
+
+		if(!a.cpus.empty())
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for(int cpu: a.cpus)
+				CPU_SET(cpu, &set);
+			if(sched_setaffinity(0, sizeof set, &set) == -1)
+				die_in_child("set the CPUs", argv);
+		}
+
+		if(a.nice)
+		{
+			errno = 0;
+			if(::nice(a.nice) == -1 && errno)
+				die_in_child("set the niceness", argv);
+		}
+
+		/* No libc wrapper, 13 is IOPRIO_CLASS_SHIFT and 1 IOPRIO_WHO_PROCESS */
+		if(a.io_class && syscall(SYS_ioprio_set, 1, 0, a.io_class << 13 | a.io_level) == -1)
+			die_in_child("set the IO priority", argv);
+
+		/* Caps, they never raise the soft or the hard limit we have */
+		for(const auto& [resource, value]: a.limits)
+		{
+			rlimit limit;
+			if(getrlimit(resource, &limit) == -1)
+				die_in_child("get a resource limit", argv);
+			if(value < limit.rlim_max)
+				limit.rlim_max = value;
+			limit.rlim_cur = std::min(limit.rlim_cur, value);
+			if(setrlimit(resource, &limit) == -1)
+				die_in_child("set a resource limit", argv);
+		}
 	}
 }
 
-inline Proc createProcess(const char* const argv[], fd_t in, fd_t out, fd_t err)
+inline Proc createProcess(const char* const argv[], fd_t in, fd_t out, fd_t err, const ExecAttrs* attrs)
 {
 	using _cppipe::redirect;
 
@@ -70,10 +209,12 @@ inline Proc createProcess(const char* const argv[], fd_t in, fd_t out, fd_t err)
 
 	Proc p;
 
+	_cppipe::reap_unwaited();
+
 	fd_t childIn[2], childOut[2], childErr[2];
 	if(in_redir)
 	{
-		pipe(childIn);
+		pipe2(childIn, O_CLOEXEC);
 		p.in  = childIn[1];
 	}
 	else
@@ -81,7 +222,7 @@ inline Proc createProcess(const char* const argv[], fd_t in, fd_t out, fd_t err)
 
 	if(out_redir)
 	{
-		pipe(childOut);
+		pipe2(childOut, O_CLOEXEC);
 		p.out = childOut[0];
 	}
 	else
@@ -89,30 +230,37 @@ inline Proc createProcess(const char* const argv[], fd_t in, fd_t out, fd_t err)
 
 	if(err_redir)
 	{
-		pipe(childErr);
+		pipe2(childErr, O_CLOEXEC);
 		p.err = childErr[0];
 	}
 	else
 		p.err = err;
 
-	p.pid = fork();
-	if(p.pid == 0)	/* child */
+	if(attrs && attrs->ring)
 	{
-		/* Close write side */
 		if(in_redir)
-			close(childIn[1]);
-
-		/* Close read side */
+			p.in_ring = _cppipe::create_ring(childIn[0]);
 		if(out_redir)
-			close(childOut[0]);
-		if(err_redir)
-			close(childErr[0]);
+			p.out_ring = _cppipe::create_ring(childOut[0]);
+	}
+	const fd_t child_in_ring = in_redir ? p.in_ring : attrs ? attrs->in_ring : -1;
 
+	p.pid = fork();
+	if(p.pid == 0)	/* child */
+	{
 		/* Take pipe as standart in, out, err */
 		redirect(in_redir ? childIn[0] : in, STDIN_FILENO);
 		redirect(out_redir ? childOut[1] : out, STDOUT_FILENO);
 		redirect(err_redir ? childErr[1] : err, STDERR_FILENO);
 
+		/* Our pipes and files are O_CLOEXEC, FDs the script opened without it are
+		   passed on on purpose e.g. a make jobserver, so only the rings are placed */
+		if(child_in_ring != -1 || p.out_ring != -1)
+			_cppipe::place_rings(child_in_ring, p.out_ring);
+
+		if(attrs)
+			_cppipe::apply_attrs(*attrs, argv);
+
 		exec_or_die(argv);
 	}
 	else			/* parent */
@@ -126,6 +274,9 @@ inline Proc createProcess(const char* const argv[], fd_t in, fd_t out, fd_t err)
 			close(childOut[1]);
 		if(err_redir)
 			close(childErr[1]);
+
+		if(_cppipe::tracing())
+			_cppipe::trace_spawn(argv, p);
 	}
 
 	return p;
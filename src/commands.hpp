@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include "childProcess.hpp"
 
 /* All CONST references are used and cast away to allow for taking
@@ -31,12 +32,31 @@ public:
 
 	/* Append arguments */
 	void append_args(std::initializer_list<const char*>);
+	/* Append the strings, which must outlive the command e.g. the result of glob() */
+	void append_args(const std::vector<std::string>&);
 	/* Append an argument and return the new command */
 	Cmd operator+(const char* arg);
 	/* Append an argument */
 	Cmd& operator+=(const char* arg);
 
+	/* Set how the command's process runs, they return the command so they can be chained
+	   e.g.: Cmd("gzip", "big.log").on_cpus({ 6, 7 }).nice(10) | ...  */
+	/* Run only on these CPUs */
+	Cmd& on_cpus(std::initializer_list<int> cpus);
+	/* Add to the niceness, like nice -n */
+	Cmd& nice(int increment);
+	/* IO scheduling class and level (0-7), like ionice */
+	Cmd& ionice(IoClass, int level = 0);
+	/* Cap a resource e.g. RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE, like ulimit */
+	Cmd& limit(int resource, rlim_t value);
+	/* Run in a cgroup v2 directory e.g. /sys/fs/cgroup/batch, if we may move processes there */
+	Cmd& cgroup(const char* dir);
+	/* Offer a shared memory ring with the pipes of its stdin and stdout, used if both sides
+	   are cppipe programs that use a RingReader and a RingWriter, see ring.hpp */
+	Cmd& ring();
+
 	std::vector<const char*> argv; /* null terminateded arg list */
+	ExecAttrs attrs;
 };
 
 /*  An instance of a shell comand that is pending execution
@@ -61,10 +81,28 @@ public:
 	/* Prevent a pending command from being executed on destruction */
 	void cancel();
 
+	/* Close the fd once the command is started, e.g. a file opened for a redirect */
+	void own(fd_t);
+
+	/* The args of the commands piped to this one, each ended by a nullptr */
+	const std::vector<const char*>& upstream_argv() const;
+
 	Cmd cmd;
 	fd_t in=0, out=1, err=2;
 private:
+	/* The last command of a pipeline, in is the pipe from the upstream processes
+	   and in_ring the ring offered with it or -1 */
+	PendingCmd(Cmd, fd_t in, std::vector<pid_t> upstream, std::vector<const char*> upstream_argv, fd_t in_ring);
+
+	/* Create the process and close the owned fds */
+	Proc start();
+
 	bool execed_ = false;
+	std::vector<fd_t> owned_fds_;
+	std::vector<pid_t> upstream_;	/* waited after this command, like the shell waits a pipeline */
+	std::vector<const char*> upstream_argv_;
+
+	friend PendingCmd operator|(const PendingCmd&, const Cmd&);
 
 	friend Proc detach(const PendingCmd&);
 	friend Proc detachRedirIn(const PendingCmd&);
@@ -146,6 +184,19 @@ PendingCmd& operator>>=(const PendingCmd&, fd_t);
 PendingCmd& operator<(const PendingCmd&, const char* file);
 PendingCmd& operator<(const PendingCmd&, fd_t);
 
+/* Data for the input of a command, see from_memory */
+struct MemoryInput
+{
+	fd_t fd;	/* closed by the command it is given to */
+};
+
+/* Input from memory, the command reads the data while we go on
+   shell:   cmd <<< "$data"
+   becomes: cmd < from_memory(data)
+   The data is copied once, into a pipe if it fits, else into a sealed memfd */
+MemoryInput from_memory(std::string_view data);
+PendingCmd& operator<(const PendingCmd&, MemoryInput);
+
 /* Shell operator & but only for single processes
    e.g.: echo a && echo b & echo c
    in shell would detach "echo a && echo b" but here
@@ -164,7 +215,7 @@ PendingCmd operator&(const PendingCmd&, const Cmd&);
 // 	operator const char*() { return c_str();}
 // };
 
-/* Execute a command and capture the output, remove trailing newlines like the shell version
+/* Execute a command, wait for it and capture the output, remove trailing newlines like the shell version
    shell:
    var=$(ls)
    becomes:
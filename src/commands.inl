@@ -3,11 +3,13 @@
 #include <assert.h>
 #include <limits.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include "commands.hpp"
 #include "childProcess.hpp"
+#include "trace.hpp"
 
 enum constants: I32
 {
@@ -18,14 +20,28 @@ namespace _cppipe
 {
 	inline fd_t open_or_die(const char* file, I32 flags)
 	{
-		fd_t fd = open(file, flags, FILE_PERMISIONS);
+		fd_t fd = open(file, flags | O_CLOEXEC, FILE_PERMISIONS);
 		if(fd == -1)
 		{
 			std::cerr << "Can't open: " << file << ' ' << strerror(errno) << std::endl;
 			exit(1);
 		}
+
+		if(tracing())
+		{
+			TraceArgs args;
+			args.add("file", file).add("fd", fd).add("flags", flags);
+			trace_event("open", 'i', now_us(), &args);
+		}
 		return fd;
 	}
+
+	inline void trace_redirect(const char* stream, const PendingCmd& c, fd_t fd)
+	{
+		TraceArgs args;
+		args.add("stream", stream).add("fd", fd).add("argv", c.cmd.argv.data());
+		trace_event("redirect", 'i', now_us(), &args);
+	}
 }
 
 template<typename... Args>
@@ -42,7 +58,7 @@ inline Cmd::Cmd(std::initializer_list<const char*> args)
 
 inline DeadProc Cmd::operator()(fd_t in, fd_t out, fd_t err) const
 {
-	Proc p = createProcess(argv.data(), in, out, err);
+	Proc p = createProcess(argv.data(), in, out, err, &attrs);
 	return wait(p);
 }
 
@@ -55,6 +71,15 @@ inline void Cmd::append_args(std::initializer_list<const char*> args)
 	argv.push_back(nullptr);
 }
 
+inline void Cmd::append_args(const std::vector<std::string>& args)
+{
+	argv.pop_back();
+	argv.reserve(argv.size() + args.size() + 1);
+	for(const std::string& arg: args)
+		argv.push_back(arg.c_str());
+	argv.push_back(nullptr);
+}
+
 inline Cmd Cmd::operator+(const char* arg)
 {
 	Cmd result(*this);
@@ -70,6 +95,43 @@ inline Cmd& Cmd::operator+=(const char* arg)
 	return *this;
 }
 
+inline Cmd& Cmd::on_cpus(std::initializer_list<int> cpus)
+{
+	attrs.cpus = cpus;
+	return *this;
+}
+
+inline Cmd& Cmd::nice(int increment)
+{
+	attrs.nice = increment;
+	return *this;
+}
+
+inline Cmd& Cmd::ionice(IoClass io_class, int level)
+{
+	attrs.io_class = io_class;
+	attrs.io_level = level;
+	return *this;
+}
+
+inline Cmd& Cmd::limit(int resource, rlim_t value)
+{
+	attrs.limits.emplace_back(resource, value);
+	return *this;
+}
+
+inline Cmd& Cmd::cgroup(const char* dir)
+{
+	attrs.cgroup = dir;
+	return *this;
+}
+
+inline Cmd& Cmd::ring()
+{
+	attrs.ring = true;
+	return *this;
+}
+
 inline PendingCmd::PendingCmd(std::initializer_list<const char*> cmd_args)
 	: cmd(cmd_args)
 	, in(0)
@@ -84,29 +146,85 @@ inline PendingCmd::PendingCmd(Cmd origin, fd_t in, fd_t out, fd_t err)
 	, err(err)
 {}
 
+inline PendingCmd::PendingCmd(Cmd origin, fd_t in, std::vector<pid_t> upstream,
+                               std::vector<const char*> upstream_argv, fd_t in_ring)
+	: cmd(std::move(origin))
+	, in(in)
+	, owned_fds_{ in }
+	, upstream_(std::move(upstream))
+	, upstream_argv_(std::move(upstream_argv))
+{
+	cmd.attrs.in_ring = in_ring;
+	if(in_ring != -1)
+		owned_fds_.push_back(in_ring);
+}
+
 inline PendingCmd::~PendingCmd()
 {
 	if(!execed_)
-		cmd(in, out, err);
+		(*this)();
 }
 
 inline DeadProc PendingCmd::operator()()
 {
-	assert(!execed_ && "Executed command twice");
-	execed_ = true;
-	return cmd(in, out, err);
+	DeadProc dead = wait(start());
+
+	// The status of a pipeline is of its last command
+	for(pid_t pid: upstream_)
+		wait(Proc{ pid, 0, 1, 2 });
+	upstream_.clear();
+
+	return dead;
 }
 
 inline void PendingCmd::cancel()
 {
 	execed_ = true;
+	for(fd_t fd: owned_fds_)
+		close(fd);
+	owned_fds_.clear();
+	for(pid_t pid: upstream_)
+		_cppipe::wait_later(pid);
+	upstream_.clear();
+}
+
+inline void PendingCmd::own(fd_t fd)
+{
+	owned_fds_.push_back(fd);
+}
+
+inline const std::vector<const char*>& PendingCmd::upstream_argv() const
+{
+	return upstream_argv_;
+}
+
+inline Proc PendingCmd::start()
+{
+	assert(!execed_ && "Executed command twice");
+	execed_ = true;
+
+	Proc p = createProcess(cmd.argv.data(), in, out, err, &cmd.attrs);
+
+	// The child has its own copies
+	for(fd_t fd: owned_fds_)
+		close(fd);
+	owned_fds_.clear();
+	return p;
 }
 
 inline std::string $(const PendingCmd& c)
 {
+	_cppipe::TraceSpan span("$()");
+
 	Proc p = detachRedirOut(c);
 
 	std::string output = read_to_end(p.out);
+	if(p.out_ring != -1)
+		close(p.out_ring);
+	wait(p);
+
+	if(_cppipe::tracing())
+		span.args.add("argv", c.cmd.argv.data()).add("pid", p.pid).add("bytes", output.size());
 
 	// Remove trailing newlines
 	int i = output.size() - 1;
@@ -119,7 +237,7 @@ inline std::string $(const PendingCmd& c)
 	return output;
 }
 
-std::string read_to_end(fd_t fd)
+inline std::string read_to_end(fd_t fd)
 {
 	// write to the string directly, todo: find a better way
 	std::string output;
@@ -146,6 +264,13 @@ std::string read_to_end(fd_t fd)
 
 inline void exec(const Cmd& c)
 {
+	if(_cppipe::tracing())
+	{
+		_cppipe::TraceArgs args;
+		_cppipe::trace_event("exec", 'i', _cppipe::now_us(), &args.add("argv", c.argv.data()));
+	}
+
+	_cppipe::apply_attrs(c.attrs, c.argv.data());
 	exec_or_die(c.argv.data());
 }
 
@@ -157,10 +282,14 @@ inline DeadProc run(const PendingCmd& c)
 inline Proc detach(const PendingCmd& ccmd)
 {
 	auto& c = const_cast<PendingCmd&>(ccmd);
-	assert(!c.execed_ && "Executed command twice");
+	Proc p = c.start();
+
+	// Only the last process is returned to be waited
+	for(pid_t pid: c.upstream_)
+		_cppipe::wait_later(pid);
+	c.upstream_.clear();
 
-	c.execed_ = true;
-	return createProcess(c.cmd.argv.data(), c.in, c.out, c.err);
+	return p;
 }
 
 inline Proc detachRedirIn(const PendingCmd& ccmd)
@@ -204,10 +333,17 @@ inline PendingCmd operator,(DeadProc, const Cmd& right)
 	return PendingCmd(right);
 }
 
-inline PendingCmd operator|(const PendingCmd& left, const Cmd& right)
+inline PendingCmd operator|(const PendingCmd& cleft, const Cmd& right)
 {
-	fd_t leftOut = detachRedirOut(left).out;
-	return PendingCmd(right, leftOut);
+	auto& left = const_cast<PendingCmd&>(cleft);
+	std::vector<pid_t> upstream = std::move(left.upstream_);
+	left.upstream_.clear();
+	std::vector<const char*> upstream_argv = std::move(left.upstream_argv_);
+	upstream_argv.insert(upstream_argv.end(), left.cmd.argv.begin(), left.cmd.argv.end());
+
+	Proc leftProc = detachRedirOut(left);
+	upstream.push_back(leftProc.pid);
+	return PendingCmd(right, leftProc.out, std::move(upstream), std::move(upstream_argv), leftProc.out_ring);
 }
 
 
@@ -256,7 +392,9 @@ inline DeadProc operator||(DeadProc p, const Cmd& ccmd)
 inline PendingCmd& operator>(const PendingCmd& c, const char* file)
 {
 	fd_t fd = _cppipe::open_or_die(file, O_WRONLY | O_CREAT);
-	return c > fd;
+	PendingCmd& redirected = c > fd;
+	redirected.own(fd);
+	return redirected;
 }
 inline PendingCmd& operator>(const PendingCmd& ccmd, fd_t fd)
 {
@@ -264,13 +402,17 @@ inline PendingCmd& operator>(const PendingCmd& ccmd, fd_t fd)
 	assert(c.out == 1 && "ERROR: Output is already redirected!");
 
 	c.out = fd;
+	if(_cppipe::tracing())
+		_cppipe::trace_redirect("out", c, fd);
 	return c;
 }
 
 inline PendingCmd& operator>>(const PendingCmd& c, const char* file)
 {
 	fd_t fd = _cppipe::open_or_die(file, O_WRONLY | O_CREAT | O_APPEND);
-	return c > fd;
+	PendingCmd& redirected = c > fd;
+	redirected.own(fd);
+	return redirected;
 }
 inline PendingCmd& operator>>(const PendingCmd& c, fd_t fd)
 {
@@ -280,7 +422,9 @@ inline PendingCmd& operator>>(const PendingCmd& c, fd_t fd)
 inline PendingCmd& operator>=(const PendingCmd& c, const char* file)
 {
 	fd_t fd = _cppipe::open_or_die(file, O_WRONLY | O_CREAT);
-	return c >= fd;
+	PendingCmd& redirected = c >= fd;
+	redirected.own(fd);
+	return redirected;
 }
 inline PendingCmd& operator>=(const PendingCmd& ccmd, fd_t fd)
 {
@@ -288,13 +432,17 @@ inline PendingCmd& operator>=(const PendingCmd& ccmd, fd_t fd)
 	assert(c.err == 2 && "ERROR: Error output is already redirected!");
 
 	c.err = fd;
+	if(_cppipe::tracing())
+		_cppipe::trace_redirect("err", c, fd);
 	return c;
 }
 
 inline PendingCmd& operator>>=(const PendingCmd& c, const char* file)
 {
 	fd_t fd = _cppipe::open_or_die(file, O_WRONLY | O_CREAT | O_APPEND);
-	return c >= fd;
+	PendingCmd& redirected = c >= fd;
+	redirected.own(fd);
+	return redirected;
 }
 inline PendingCmd& operator>>=(const PendingCmd& c, fd_t fd)
 {
@@ -304,7 +452,9 @@ inline PendingCmd& operator>>=(const PendingCmd& c, fd_t fd)
 inline PendingCmd& operator<(const PendingCmd& c, const char* file)
 {
 	fd_t fd = _cppipe::open_or_die(file, O_RDONLY);
-	return c < fd;
+	PendingCmd& redirected = c < fd;
+	redirected.own(fd);
+	return redirected;
 }
 inline PendingCmd& operator<(const PendingCmd& ccmd, fd_t fd)
 {
@@ -312,9 +462,66 @@ inline PendingCmd& operator<(const PendingCmd& ccmd, fd_t fd)
 	assert(c.in == 0 && "ERROR: Input is already redirected!");
 
 	c.in = fd;
+	if(_cppipe::tracing())
+		_cppipe::trace_redirect("in", c, fd);
 	return c;
 }
 
+inline MemoryInput from_memory(std::string_view data)
+{
+	// Small data fits in a pipe, so writing it never waits for the reader
+	fd_t fds[2];
+	if(pipe2(fds, O_CLOEXEC) == -1)
+	{
+		std::cerr << "Can't create a pipe: " << strerror(errno) << std::endl;
+		exit(1);
+	}
+	if(data.size() <= (size_t)fcntl(fds[1], F_GETPIPE_SZ))
+	{
+		if(!data.empty())
+			write(fds[1], data.data(), data.size());
+		close(fds[1]);
+		return { fds[0] };
+	}
+	close(fds[0]);
+	close(fds[1]);
+
+	// Else a file in memory, sealed so nobody can change what the command reads
+	fd_t fd = memfd_create("cppipe_input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd == -1)
+	{
+		std::cerr << "Can't create a memfd: " << strerror(errno) << std::endl;
+		exit(1);
+	}
+	for(size_t done = 0; done < data.size(); )
+	{
+		ssize_t n = write(fd, data.data() + done, data.size() - done);
+		if(n == -1)
+		{
+			std::cerr << "Can't write to a memfd: " << strerror(errno) << std::endl;
+			exit(1);
+		}
+		done += n;
+	}
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+	lseek(fd, 0, SEEK_SET);
+
+	if(_cppipe::tracing())
+	{
+		_cppipe::TraceArgs args;
+		args.add("fd", fd).add("bytes", data.size());
+		_cppipe::trace_event("memfd", 'i', _cppipe::now_us(), &args);
+	}
+	return { fd };
+}
+
+inline PendingCmd& operator<(const PendingCmd& c, MemoryInput input)
+{
+	PendingCmd& redirected = c < input.fd;
+	redirected.own(input.fd);
+	return redirected;
+}
+
 inline PendingCmd operator&(const PendingCmd& left, const Cmd& right)
 {
 	detach(left);
@@ -1,15 +1,29 @@
 #include <cstdlib>
 #include <cstring>
+#include <cstdio>
+#include <cmath>
 #include <filesystem>
 #include <iostream>
-#include <fstream>
 #include <string_view>
 #include <optional>
+#include <algorithm>
+#include <unordered_map>
+#include <set>
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 #include "commands.hpp"
+#include "cache.hpp"
 #include "../config.h"
 
 using namespace std;
@@ -21,6 +35,33 @@ enum SrcType
 	CPP
 };
 
+// How the cached binary was found to be up to date
+enum CacheResult
+{
+	HIT,			// timestamps were enough
+	COMPARE_HIT,		// the preprocessed source was unchanged
+	COMPILED
+};
+
+// Exit code of a process that compiles a source for --prewarm or --watch,
+// any other one is a failure
+enum JobResult
+{
+	JOB_UP_TO_DATE,
+	JOB_FAILED,
+	JOB_COMPILED
+};
+
+// Steps of a cppipe run that are timed by --stats
+enum Phase
+{
+	FIND,
+	CACHE_DIR,
+	PREPROCESS,
+	COMPILE,
+	PHASE_COUNT
+};
+
 namespace
 {
 
@@ -37,27 +78,137 @@ struct MappedFile		// todo: move to utils
 // process the args until the src file arg is found, return its index
 int parse_args_until_src(int argc, char* argv[]);
 
+// exit with an error if an option of --export is given without it,
+// the cache only holds builds for the CPU it runs on
+void check_export_options();
+
+// if the cached binary is up to date run it right away,
+// returns only if the slow path is needed
+void exec_if_cached(int argc, char* argv[], int src_arg);
+
+// search the source file like the shell searches PATH, fill st with its stat
+// return the path as found or an empty string if it doesn't exist
+string search_src(string_view src_file, struct stat& st);
+
+// the absolute path of a source as it was found, not canonical
+string absolute_src(const string& found);
+
 // find the source file to run, if it doesn't exist, exit program
 fs::path find_path_to_src(string_view src_file);
 
 // find the path of the cache for the given src_file path
 fs::path get_cache_dir_path(const fs::path& src_file);
 
+// set up the context for the source file given on the command line
+void init_context(string_view src_arg);
+
+// the index file of the binary of a source as it was found
+string index_of(const string& found);
+
+// separates the cache entries of the same source compiled with different additional_compiler_args
+// or as a shared object, empty without them
+string args_variant();
+
+// compile the src for each set of flags, then run the binaries and report
+// their times and memory use, return the exit code
+int bench(int argc, char* argv[], int src_arg);
+
+// compile the sources at the paths and the scripts found in the directories among them,
+// the stale ones are compiled in parallel, return the exit code
+int prewarm(int count, char* paths[]);
+
+// the files at the paths and the scripts found in the directories among them,
+// the directories searched are added to dirs if given
+vector<string> collect_sources(int count, char* paths[], vector<string>* dirs = nullptr);
+
+// compile the sources in parallel, one process per core, return a JobResult for each
+vector<int> compile_sources(const vector<string>& srcs);
+
+// recompile the sources of prewarm in the background whenever they or their headers change
+int watch(int count, char* paths[]);
+
+// whether a file found in a directory passed to --prewarm is a cppipe script
+bool is_script(const fs::path& file);
+
 // map file in memory with write permissions
 MappedFile mapfile_for_writing(const fs::path& file);
 
+// write a temporary file and rename it over file, so readers never see it half written
+void replace_file(const fs::path& file, string_view content);
+
+// take the lock of the cache entry, only one cppipe at a time updates it
+// the lock is released when the returned fd is closed
+fd_t lock_cache_entry();
+
 // preprocess the src file, compare and overwrite the result to the previous version
 // return whether there was a difference
 bool preprocess_and_compare();
 
+// read the "// cppipe: KEY=VALUE,VALUE..." build directives of the src
+void parse_directives(string_view src);
+
+// compile the sources given by the directives to cached objects, the ones that are
+// not up to date in parallel, return whether any was compiled
+bool build_objects();
+
+// append the dependencies listed in a depfile written by -MMD, false if it can't be read
+bool read_depfile(const string& depfile, vector<string>& deps);
+
+// append CFLAGS or CXXFLAGS and the -march flag, whole_program keeps -fwhole-program
+void append_language_flags(Cmd& cmd, SrcType type, bool whole_program);
+
 // only recompile if changes are present
 void compile_src_file();
 
+// whether a fresh binary of the given tier is good enough for this run
+bool tier_acceptable(int tier);
+
+// the command that compiles a preprocessed source to out, as a build of the given tier
+// in and out are kept, not copied
+Cmd compile_command(const char* in, const char* out, int tier);
+
+// replace a quick or a profile collecting binary with the next tier, in a background process
+void start_background_build();
+
+// add a run of a binary that collects a profile, return the number of runs so far
+I64 count_training_run(const string& bin);
+
+// fork a process that isn't our child, so the program we exec never waits for it
+// returns true in the new process, its std fds are /dev/null
+bool fork_detached();
+
+// compile the src to a standalone binary at export_path outside of the cache,
+// with a manifest of how it was built, return the exit code
+int export_binary(string_view src_arg);
+
+// C string literal of text
+string c_string_literal(string_view text);
+
+// record what the binary was built from, so the next run can use exec_if_cached
+void update_stamp();
+
+// point the index entry of the src at the stamp of the binary
+void link_index();
+
 void print_usage();
 
 SrcType find_src_type(string_view path);
 
+// add this run to the counters in the cache and print them if --stats was given
+void record_stats();
+
+// remove cache entries beyond the limits in config.h,
+// the ones whose source is gone first, then the least recently used
+void collect_garbage(bool verbose);
+
+// run collect_garbage in a detached process if it didn't run for GC_INTERVAL
+void maybe_collect_garbage();
+
 const char DEBUG_PREFIX[] = "__DBG";
+const char STATS_FILE[] = ".stats";
+const char GC_FILE[] = ".gc";	// its mtime is the time of the last collection
+const I64 GC_INTERVAL = 24 * 60 * 60;
+const int WATCH_DEBOUNCE_MS = 100;	// wait for a quiet period before compiling saved files
 
 // Context
 fs::path src_file;
@@ -65,6 +216,25 @@ SrcType src_type;
 fs::path cache_dir;
 fs::path preprocessed_file;
 fs::path bin;   // cache bins to avoid recompiles
+string abs_src; // src_file made absolute, the key of the cache index
+string build_key;	// of the compiler and the CPU, binaries for other ones are kept apart
+_cppipe::Dependency src_dep;	// state of the src when it was preprocessed
+vector<string> src_includes;	// files included by the src
+vector<string> src_system_headers;	// system headers included by the src
+U64 pp_hash;			// of the preprocessed src
+int bin_tier = _cppipe::TIER_OPTIMIZED;	// tier of the cached bin
+fs::path pgo_dir;		// profile and the source it was collected from
+I64 training_runs = 0;		// counted by exec_if_cached, 0 if it didn't
+string debug_remap;		// keep the compile arguments alive
+string pgo_dumpbase;
+
+// Build directives of the src
+string directives;		// the directive lines, compared together with the preprocessed src
+vector<string> directive_sources;	// other translation units, absolute
+vector<string> directive_libs;	// -lNAME
+vector<string> directive_flags;	// passed to every compile
+vector<string> objects;		// cached objects of the directive_sources
+vector<string> object_deps;	// the files the objects were compiled from
 
 // Options
 bool debug = false;
@@ -72,7 +242,38 @@ bool debug = false;
 bool quick = false;
 // Just compile, don't run
 bool dont_run = false;
+// Build a shared object for call() and print its path instead of running it
+bool shared_lib = false;
 vector<const char*> additional_compiler_args;
+// Runs of --bench, the binary is run that many times after the warmup runs
+int bench_runs = 0;
+int bench_warmup = 1;
+// The compiler args to compare with, split from --vs
+vector<string> bench_vs;
+bool bench_compare = false;
+// Print timing and cache statistics
+bool print_stats = false;
+// Run a quick build first and optimize in the background
+bool tiered = false;
+// Profile guided optimization
+bool pgo = false;
+// -march flag, empty for the compiler's default
+string march = MARCH_FLAG;
+// Where to export a standalone binary to, with which options
+const char* export_path = nullptr;
+bool export_static = false;
+bool export_lto = false;
+string export_march;	// empty for a portable binary
+
+// Statistics of this run
+CacheResult cache_result;
+I64 phase_us[PHASE_COUNT] = {};
+
+// Add the time since begin to a phase
+void add_phase_time(Phase phase, I64 begin)
+{
+	phase_us[phase] += _cppipe::now_us() - begin;
+}
 
 }
 
@@ -80,22 +281,33 @@ int main(int argc, char* argv[])
 {
 	int src_arg = parse_args_until_src(argc, argv);
 
-	// Init context
-	src_file = find_path_to_src( argv[src_arg] );
-	src_type = find_src_type( argv[src_arg] );
-	cache_dir = get_cache_dir_path(src_file);
+	if(export_path)
+		return export_binary(argv[src_arg]);
 
-	preprocessed_file = cache_dir / (debug ? DEBUG_PREFIX : "") += src_file.stem()
-		+= (src_type == SrcType::C ? ".i" : ".ii");
+	if(bench_runs)
+		return bench(argc, argv, src_arg);
 
-	bin = cache_dir / (debug ? DEBUG_PREFIX : "") += src_file.filename();
+	// Nothing to run, so all the files are sources
+	if(dont_run && src_arg + 1 < argc)
+		return prewarm(argc - src_arg, argv + src_arg);
+
+	exec_if_cached(argc, argv, src_arg);
+
+	init_context(argv[src_arg]);
 
 	// Compile the src
 	compile_src_file();
 
+	if(print_stats || getenv("CPPIPE_STATS"))
+		record_stats();
+
 	// Run the src file without forking
 	if(dont_run)
+	{
+		if(shared_lib)
+			cout << bin.string() << '\n';
 		return 0;
+	}
 
 	Cmd run;
 	if(debug)			   // debug it with gdb
@@ -114,6 +326,15 @@ int main(int argc, char* argv[])
 namespace
 {
 
+void check_export_options()
+{
+	if(!export_path && (export_static || export_lto || !export_march.empty()))
+	{
+		cerr << "ERROR: --static, --lto and --march are only used with --export\n";
+		exit(1);
+	}
+}
+
 int parse_args_until_src(int argc, char* argv[])
 {
 	if(argc < 2)
@@ -122,6 +343,9 @@ int parse_args_until_src(int argc, char* argv[])
 		exit(1);
 	}
 
+	tiered = getenv("CPPIPE_TIERED");
+	pgo = getenv("CPPIPE_PGO");
+
 	int src_arg = 0;
 	for(int i = 1; i < argc; ++i)
 	{
@@ -135,13 +359,43 @@ int parse_args_until_src(int argc, char* argv[])
 				"Options:\n"
 				"-g debug the binary, asserts are also enabled\n"
 				"-q quicker, just compare source and binary time stamps, if included files were updated a recompile WON'T occur!\n"
-				"-n don't run, just compile the file without running it\n\n"
+				"-n don't run, just compile the file without running it,\n"
+				"   the ARGUMENTs are then compiled as well, like with --prewarm\n"
+				"-t tiered, if the binary needs a compile, run an unoptimized build right away,\n"
+				"   the optimized one is compiled in the background for the next runs\n"
+				"--pgo profile guided optimization, build the binary to collect a profile\n"
+				"      during its next runs, then replace it with a build that uses the profile\n"
+				"--shared build a shared object that call() can load in-process, print its path\n"
+				"--stats print how long each step took and whether the cached binary was used,\n"
+				"        together with the totals of all runs recorded in the cache\n"
+				"--prewarm PATH... compile the given files and the scripts in the given directories,\n"
+				"                  (files with a cppipe #! line or a .cppipe extension) in parallel\n"
+				"--watch PATH... like --prewarm, then keep recompiling the sources whenever\n"
+				"                they or the headers they include change, until interrupted\n"
+				"--bench N run the compiled binary N times and print the min, median, 95th percentile\n"
+				"          and standard deviation of its wall, user and sys time and max RSS, with:\n"
+				"    --warmup K   runs before the measured ones, 1 by default\n"
+				"    --vs FLAGS   compare with a build with these compiler flags instead,\n"
+				"                 e.g. cppipe --bench 20 -O3 --vs -O2 FILE\n"
+				"--export OUT build a standalone binary OUT outside of the cache, for machines\n"
+				"             without a compiler, portable unless --march is given, with:\n"
+				"    --static     link statically\n"
+				"    --lto        link time optimization\n"
+				"    --march=ARCH the -march of the compiler e.g. native, x86-64-v3\n"
+				"--gc remove the binaries of deleted sources and the least recently used ones\n"
+				"     beyond the cache limits, then exit\n\n"
 
 				"Any other argument that begins with '-' is passed to the compiler e.g.:\n"
 				"    cppipe -O0 file.cpp\n\n"
 
 				"Environment variables:\n"
-				"CPPIPEPATH - ':'-separated list of directories to prepend to the FILE search path\n";
+				"CPPIPEPATH - ':'-separated list of directories to prepend to the FILE search path\n"
+				"CPPIPE_CACHE_MAX_SIZE - limit of the cache size in MiB, 0 for none\n"
+				"CPPIPE_CACHE_MAX_AGE - days after which unused binaries are removed, 0 for never\n"
+				"CPPIPE_TIERED - if set, always use -t\n"
+				"CPPIPE_PGO - if set, always use --pgo\n"
+				"CPPIPE_STATS - if set, record the statistics of every run, even without --stats\n"
+				"CPPIPE_TRACE - append a Chrome trace JSON timeline of cppipe and the commands it runs to this file\n";
 			exit(0);
 		}
 		else if( arg == "-g" )
@@ -156,6 +410,94 @@ int parse_args_until_src(int argc, char* argv[])
 		{
 			dont_run = true;
 		}
+		else if( arg == "-t" )
+		{
+			tiered = true;
+		}
+		else if( arg == "--pgo" )
+		{
+			pgo = true;
+		}
+		else if( arg == "--shared" )
+		{
+			shared_lib = true;
+			dont_run = true;
+		}
+		else if( arg == "--stats" )
+		{
+			print_stats = true;
+		}
+		else if( arg == "--prewarm" )
+		{
+			if(i + 1 == argc)
+			{
+				print_usage();
+				exit(1);
+			}
+			check_export_options();
+			exit( prewarm(argc - i - 1, argv + i + 1) );
+		}
+		else if( arg == "--watch" )
+		{
+			if(i + 1 == argc)
+			{
+				print_usage();
+				exit(1);
+			}
+			check_export_options();
+			exit( watch(argc - i - 1, argv + i + 1) );
+		}
+		else if( arg == "--bench" || arg == "--warmup" || arg == "--vs" )
+		{
+			if(i + 1 == argc)
+			{
+				print_usage();
+				exit(1);
+			}
+			const char* value = argv[++i];
+			if(arg == "--bench")
+				bench_runs = max(1, atoi(value));
+			else if(arg == "--warmup")
+				bench_warmup = max(0, atoi(value));
+			else
+			{
+				bench_compare = true;
+				for(const char* flag = value; *flag; )
+				{
+					const char* end = strchrnul(flag, ' ');
+					if(end != flag)
+						bench_vs.emplace_back(flag, end);
+					flag = *end ? end + 1 : end;
+				}
+			}
+		}
+		else if( arg == "--export" )
+		{
+			if(i + 1 == argc)
+			{
+				print_usage();
+				exit(1);
+			}
+			export_path = argv[++i];
+		}
+		else if( arg == "--static" )
+		{
+			export_static = true;
+		}
+		else if( arg == "--lto" )
+		{
+			export_lto = true;
+		}
+		else if( arg.substr(0, 8) == "--march=" )
+		{
+			export_march = "-march=";
+			export_march += arg.substr(8);
+		}
+		else if( arg == "--gc" )
+		{
+			collect_garbage(true);
+			exit(0);
+		}
 		else if( !arg.empty() && arg[0] == '-') // if it's an unknown option pass it to the compiler
 		{
 			additional_compiler_args.push_back(argv[i]);
@@ -172,35 +514,123 @@ int parse_args_until_src(int argc, char* argv[])
 		print_usage();
 		exit(1);
 	}
+	check_export_options();
+
+	// call() loads the shared object once, it's never replaced in the background
+	if(shared_lib)
+		tiered = pgo = false;
 
 	return src_arg;
 }
 
-fs::path find_path_to_src(string_view src_file)
+void exec_if_cached(int argc, char* argv[], int src_arg)
+{
+	// Debugging isn't worth a fast path
+	if(debug)
+		return;
+
+	_cppipe::TraceSpan span("lookup");
+	const I64 begin = _cppipe::now_us();
+
+	// Only syscalls: the stat of the src, reading the index and the stats of the includes
+	struct stat st;
+	const string found = search_src(argv[src_arg], st);
+	if(found.empty())
+		return;		// the slow path reports the error
+
+	const string index = index_of(found);
+	_cppipe::Stamp stamp;
+	if(!stamp.read(index.c_str()) || !stamp.fresh(&st, quick))
+		return;
+	// Without -t a quick build is not good enough,
+	// after enough training runs the profile is used by a new build
+	if(stamp.tier == _cppipe::TIER_QUICK && !tiered)
+		return;
+	if(stamp.tier == _cppipe::TIER_PGO_TRAINING
+	   && (!pgo || (training_runs = count_training_run(stamp.bin)) > PGO_TRAINING_RUNS))
+		return;
+	stamp.mark_used(index.c_str());
+
+	add_phase_time(FIND, begin);
+	cache_result = HIT;
+	if(print_stats || getenv("CPPIPE_STATS"))
+		record_stats();
+
+	if(dont_run)
+	{
+		if(shared_lib)
+			cout << stamp.bin << '\n';
+		exit(0);
+	}
+
+	vector<const char*> run{ stamp.bin.c_str() };
+	run.insert(run.end(), argv + src_arg + 1, argv + argc);
+	run.push_back(nullptr);
+
+	if(_cppipe::tracing())
+	{
+		_cppipe::TraceArgs args;
+		_cppipe::trace_event("exec", 'i', _cppipe::now_us(), &args.add("argv", run.data()));
+	}
+	// The destructor doesn't run after a successful exec
+	span.end();
+	execv(run[0], (char* const*)run.data());
+
+	// The binary is gone, build it again
+}
+
+string search_src(string_view src_file, struct stat& st)
 {
-	if(fs::exists(src_file))	// Found relative to CWD
+	string path(src_file);
+	if(stat(path.c_str(), &st) == 0)	// Found relative to CWD
 	{
-		return src_file;
+		return path;
 	}
 
 	// Search files on CPPIPEPATH
 	const char* cppipepath_var = getenv("CPPIPEPATH");
-	if(cppipepath_var)	// is set
+	if(cppipepath_var && src_file[0] != '/')	// is set
 	{
 		const string_view cppipepath = cppipepath_var;
 		for(size_t begin = 0, end = cppipepath.find(':');
 		    end != string::npos;
 		    begin = end+1, end = cppipepath.find(':', begin) )
 		{
-			const fs::path path_entry = cppipepath.substr(begin, end - begin);
+			path = cppipepath.substr(begin, end - begin);
+			if(!path.empty() && path.back() != '/')
+				path += '/';
+			path += src_file;
 
-			if( fs::path p = path_entry / src_file; fs::exists(p) )
+			if( stat(path.c_str(), &st) == 0 )
 			{
-				return p;
+				return path;
 			}
 		}
 	}
 
+	return "";
+}
+
+string absolute_src(const string& found)
+{
+	if(found[0] == '/')
+		return found;
+
+	char cwd[PATH_MAX];
+	if(!getcwd(cwd, sizeof cwd))
+		return found;
+
+	return string(cwd) + '/' + found;
+}
+
+fs::path find_path_to_src(string_view src_file)
+{
+	struct stat st;
+	if(string found = search_src(src_file, st); !found.empty())
+	{
+		return found;
+	}
+
 	// Couldn't find the src
 	cerr << "File: " << src_file << " doesn't exist\n";
 	exit(1);
@@ -208,29 +638,390 @@ fs::path find_path_to_src(string_view src_file)
 
 fs::path get_cache_dir_path(const fs::path& src_file)
 {
-	fs::path cache_dir;
-	if(char* XDG_CACHE = getenv("XDG_CACHE_HOME"))
+	fs::path cache_dir = _cppipe::cache_root();
+	cache_dir /= build_key;
+	cache_dir += fs::canonical( src_file ).parent_path();
+	fs::create_directories(cache_dir);
+	return cache_dir;
+}
+
+void init_context(string_view src_arg)
+{
+	{
+		_cppipe::TraceSpan span("find");
+		I64 begin = _cppipe::now_us();
+		src_file = find_path_to_src( src_arg );
+		abs_src = absolute_src(src_file);
+		src_type = find_src_type( src_arg );
+		add_phase_time(FIND, begin);
+
+		begin = _cppipe::now_us();
+		build_key = _cppipe::build_key(src_type == SrcType::C ? CC : CXX);
+		cache_dir = get_cache_dir_path(src_file);
+		add_phase_time(CACHE_DIR, begin);
+	}
+
+	const string variant = args_variant();
+	preprocessed_file = cache_dir / (debug ? DEBUG_PREFIX : "") += src_file.stem();
+	preprocessed_file += variant + (src_type == SrcType::C ? ".i" : ".ii");
+
+	bin = cache_dir / (debug ? DEBUG_PREFIX : "") += src_file.filename();
+	bin += variant;
+	pgo_dir = bin.string() + ".pgo";
+}
+
+string index_of(const string& found)
+{
+	return _cppipe::index_path(_cppipe::cache_root(), absolute_src(found),
+	                           _cppipe::index_key(find_src_type(found) == SrcType::C ? CC : CXX) + args_variant());
+}
+
+string args_variant()
+{
+	const string so = shared_lib ? ".so" : "";
+	if(additional_compiler_args.empty())
+		return so;
+
+	U64 hash = _cppipe::FNV_BASIS;
+	for(const char* arg: additional_compiler_args)
+		hash = _cppipe::hash_bytes(arg, strlen(arg) + 1, hash);
+	return '+' + _cppipe::to_hex(hash).substr(0, 8) + so;
+}
+
+int bench(int argc, char* argv[], int src_arg)
+{
+	// The builds to compare, the flags given to cppipe and the --vs ones
+	vector<vector<const char*>> variants{ additional_compiler_args };
+	if(bench_compare)
 	{
-		cache_dir = XDG_CACHE;
-		cache_dir /= "cppipe";
+		variants.emplace_back();
+		for(const string& flag: bench_vs)
+			variants.back().push_back(flag.c_str());
 	}
-	else if(char* HOME = getenv("HOME"))
+
+	// Compile each in a child of its own, then find where its binary is
+	tiered = pgo = false;
+	vector<string> bins;
+	for(const vector<const char*>& args: variants)
 	{
-		cache_dir = HOME;
-		cache_dir /= ".cache/cppipe";
+		additional_compiler_args = args;
+		if(compile_sources({ argv[src_arg] })[0] == JOB_FAILED)
+			return 1;
+		init_context(argv[src_arg]);
+		bins.push_back(bin);
 	}
-	else
+
+	fd_t null = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+	// Wall ms, user ms, sys ms and max RSS KiB of every run of every variant
+	enum { WALL, USER, SYS, RSS, METRIC_COUNT };
+	vector<vector<double>> samples[METRIC_COUNT];
+	for(auto& metric: samples)
+		metric.resize(variants.size());
+
+	// Alternate the variants, so a change of the load affects all of them
+	for(int run = 0; run < bench_warmup + bench_runs; ++run)
+	{
+		for(size_t v = 0; v < variants.size(); ++v)
+		{
+			vector<const char*> run_argv{ bins[v].c_str() };
+			run_argv.insert(run_argv.end(), argv + src_arg + 1, argv + argc);
+			run_argv.push_back(nullptr);
+
+			const I64 begin = _cppipe::now_us();
+			Proc p = createProcess(run_argv.data(), null, null, null);
+			int status;
+			rusage usage;
+			if(wait4(p.pid, &status, 0, &usage) == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+			{
+				cerr << "ERROR: " << bins[v] << " failed\n";
+				return 1;
+			}
+			const I64 end = _cppipe::now_us();
+
+			if(run < bench_warmup)
+				continue;
+			samples[WALL][v].push_back((end - begin) / 1e3);
+			samples[USER][v].push_back(usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3);
+			samples[SYS][v].push_back(usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3);
+			samples[RSS][v].push_back(usage.ru_maxrss);
+		}
+	}
+	close(null);
+
+	const char* names[METRIC_COUNT] = { "wall ms", "user ms", "sys ms", "max rss KiB" };
+	vector<double> medians;
+	for(size_t v = 0; v < variants.size(); ++v)
 	{
-		cache_dir = "/var/cache/cppipe";
+		cout << argv[src_arg] << " (flags:";
+		for(const char* arg: variants[v])
+			cout << ' ' << arg;
+		cout << (variants[v].empty() ? " default" : "") << "), " << bench_runs << " runs\n";
+		printf("%-12s %10s %10s %10s %10s\n", "", "min", "median", "p95", "stddev");
+
+		for(int m = 0; m < METRIC_COUNT; ++m)
+		{
+			vector<double>& x = samples[m][v];
+			sort(x.begin(), x.end());
+			const size_t n = x.size();
+			const double median = n % 2 ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+
+			double mean = 0, variance = 0;
+			for(double value: x)
+				mean += value / n;
+			for(double value: x)
+				variance += (value - mean) * (value - mean) / (n > 1 ? n - 1 : 1);
+
+			printf("%-12s %10.3f %10.3f %10.3f %10.3f\n", names[m],
+			       x[0], median, x[(n * 95 + 99) / 100 - 1], sqrt(variance));
+			if(m == WALL)
+				medians.push_back(median);
+		}
+		cout << '\n';
 	}
-	cache_dir += fs::canonical( src_file ).parent_path();
-	fs::create_directories(cache_dir);
-	return cache_dir;
+
+	if(medians.size() == 2 && medians[1] > 0)
+		printf("median wall time of the first is %.3fx the second\n", medians[0] / medians[1]);
+
+	return 0;
+}
+
+int prewarm(int count, char* paths[])
+{
+	const vector<string> srcs = collect_sources(count, paths);
+	const vector<int> results = compile_sources(srcs);
+
+	// Report the failures together, after the compiler output
+	int compiled = 0, failed = 0;
+	for(size_t i = 0; i < srcs.size(); ++i)
+	{
+		compiled += results[i] == JOB_COMPILED;
+		failed += results[i] == JOB_FAILED;
+	}
+
+	cout << "Prewarmed " << srcs.size() << " sources: " << compiled << " compiled, "
+	     << srcs.size() - compiled - failed << " up to date, " << failed << " failed\n";
+	for(size_t i = 0; i < srcs.size(); ++i)
+	{
+		if(results[i] == JOB_FAILED)
+			cout << "FAILED: " << srcs[i] << '\n';
+	}
+
+	return failed ? 1 : 0;
+}
+
+vector<string> collect_sources(int count, char* paths[], vector<string>* dirs)
+{
+	const fs::path cache_root = _cppipe::cache_root();
+	vector<string> srcs;
+	for(int i = 0; i < count; ++i)
+	{
+		error_code ec;
+		if(!fs::is_directory(paths[i], ec))
+		{
+			srcs.push_back(paths[i]);
+			continue;
+		}
+
+		if(dirs)
+			dirs->push_back(paths[i]);
+
+		vector<string> found;
+		for(auto it = fs::recursive_directory_iterator(paths[i], fs::directory_options::skip_permission_denied, ec);
+		    it != fs::recursive_directory_iterator();
+		    it.increment(ec))
+		{
+			// The cached binaries have the names of the scripts
+			if(it->is_directory(ec) && fs::equivalent(it->path(), cache_root, ec))
+				it.disable_recursion_pending();
+			else if(it->is_directory(ec) && dirs)
+				dirs->push_back(it->path());
+			else if(it->is_regular_file(ec) && is_script(it->path()))
+				found.push_back(it->path());
+		}
+		sort(found.begin(), found.end());
+		srcs.insert(srcs.end(), found.begin(), found.end());
+	}
+	return srcs;
+}
+
+vector<int> compile_sources(const vector<string>& srcs)
+{
+	// Compile only, the tier of a binary that is run later
+	dont_run = true;
+
+	// One compile per core, each in a child with its own context
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if(jobs < 1)
+		jobs = 1;
+
+	vector<pid_t> running(srcs.size(), 0);
+	vector<int> results(srcs.size(), JOB_FAILED);
+	size_t next = 0, active = 0;
+
+	cout.flush();
+	cerr.flush();
+	while(next < srcs.size() || active)
+	{
+		if(next < srcs.size() && active < (size_t)jobs)
+		{
+			pid_t pid = fork();
+			if(pid == 0)
+			{
+				init_context(srcs[next]);
+				compile_src_file();
+				_exit(cache_result == COMPILED ? JOB_COMPILED : JOB_UP_TO_DATE);
+			}
+			if(pid == -1)
+			{
+				cerr << "ERROR: Couldn't fork " << strerror(errno) << '\n';
+				exit(1);
+			}
+			running[next++] = pid;
+			++active;
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if(pid == -1)
+			break;
+		for(size_t i = 0; i < srcs.size(); ++i)
+		{
+			if(running[i] == pid)
+			{
+				// Errors exit the child with their own codes
+				const int code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+				results[i] = code == JOB_COMPILED || code == JOB_UP_TO_DATE ? code : JOB_FAILED;
+				--active;
+			}
+		}
+	}
+
+	return results;
+}
+
+int watch(int count, char* paths[])
+{
+#ifdef __linux__
+	set<string> failed;	// not retried until something changes
+	size_t watched = 0;
+
+	for(;;)
+	{
+		vector<string> dirs;
+		const vector<string> srcs = collect_sources(count, paths, &dirs);
+
+		// Editors save by renaming over the file, so the directories are watched
+		fd_t notify = inotify_init1(IN_CLOEXEC);
+		if(notify == -1)
+		{
+			cerr << "ERROR: Couldn't watch " << strerror(errno) << '\n';
+			return 1;
+		}
+		const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB;
+		set<int> any_change;		// directories where any file matters
+		set<pair<int, string>> files;	// the files that matter in the others
+		for(const string& dir: dirs)
+			any_change.insert(inotify_add_watch(notify, dir.c_str(), mask | IN_ONLYDIR));
+
+		// The dependencies of the last build, taken from the stamps
+		vector<string> stale;
+		for(const string& src: srcs)
+		{
+			_cppipe::Stamp stamp;
+			const bool fresh = stamp.read(index_of(src).c_str()) && stamp.fresh();
+			if(!fresh && !failed.count(src))
+				stale.push_back(src);
+
+			vector<string> deps{ fs::absolute(src) };
+			for(const _cppipe::Dependency& dep: stamp.deps)
+				deps.push_back(dep.path);
+			for(const fs::path dep: deps)
+			{
+				int wd = inotify_add_watch(notify, dep.parent_path().c_str(), mask | IN_ONLYDIR);
+				if(wd != -1)
+					files.insert({ wd, dep.filename() });
+			}
+		}
+
+		// Watches are set before the check, so no change is missed while compiling
+		if(!stale.empty())
+		{
+			close(notify);
+			const vector<int> results = compile_sources(stale);
+			for(size_t i = 0; i < stale.size(); ++i)
+			{
+				if(results[i] == JOB_COMPILED)
+					cout << "Compiled " << stale[i] << '\n';
+				else if(results[i] == JOB_FAILED)
+				{
+					cout << "FAILED: " << stale[i] << '\n';
+					failed.insert(stale[i]);
+				}
+			}
+			continue;
+		}
+
+		if(srcs.size() != watched)
+		{
+			watched = srcs.size();
+			cout << "Watching " << watched << " sources\n";
+		}
+		cout.flush();
+
+		// Wait for a change, then for the changes to stop
+		bool changed = false;
+		pollfd poll_fd{ notify, POLLIN, 0 };
+		while(poll(&poll_fd, 1, changed ? WATCH_DEBOUNCE_MS : -1) > 0)
+		{
+			alignas(inotify_event) char buf[4096];
+			ssize_t len = read(notify, buf, sizeof buf);
+			for(ssize_t i = 0; i < len; )
+			{
+				const inotify_event* event = (const inotify_event*)(buf + i);
+				i += sizeof(inotify_event) + event->len;
+
+				changed = changed || (event->mask & IN_Q_OVERFLOW) || any_change.count(event->wd)
+					|| (event->len && files.count({ event->wd, event->name }));
+			}
+		}
+		close(notify);
+		failed.clear();
+	}
+#else
+	(void)count;
+	(void)paths;
+	cerr << "ERROR: --watch needs inotify\n";
+	return 1;
+#endif
+}
+
+bool is_script(const fs::path& file)
+{
+	if(file.extension() == ".cppipe")
+		return true;
+
+	// #! line that runs cppipe
+	char line[256];
+	fd_t fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd == -1)
+		return false;
+	ssize_t len = read(fd, line, sizeof line - 1);
+	close(fd);
+	if(len < 2 || line[0] != '#' || line[1] != '!')
+		return false;
+
+	line[len] = '\0';
+	char* newline = strchr(line, '\n');
+	if(newline)
+		*newline = '\0';
+	return strstr(line, "cppipe") != nullptr;
 }
 
 MappedFile mapfile_for_writing(const fs::path& file)
 {
-	fd_t fd = open(file.c_str(), O_RDWR);
+	fd_t fd = open(file.c_str(), O_RDWR | O_CLOEXEC);
 
 	MappedFile res;
 	res.len = lseek(fd, 0, SEEK_END);
@@ -248,6 +1039,8 @@ MappedFile mapfile_for_writing(const fs::path& file)
 
 bool preprocess_and_compare()
 {
+	_cppipe::TraceSpan span("preprocess_and_compare");
+
 	Cmd preprocess(
 		src_type == SrcType::C ? CC : CXX,
 		"-E"		// preprocess only
@@ -256,20 +1049,25 @@ bool preprocess_and_compare()
 		#endif
 		);
 
-	// Add preprocessor flags
-	if(src_type == SrcType::C)
-	{
-		preprocess.append_args({ CFLAGS });
-	}
-	else
-	{
-		preprocess.append_args({ CXXFLAGS });
+	// Add preprocessor flags, -march defines the macros of the instruction sets
+	append_language_flags(preprocess, src_type, true);
+	if(src_type == SrcType::CPP)
 		preprocess += "-xc++"; // treat the file as a .cpp
-	}
 
 	if(!debug)
 		preprocess +=  "-DNDEBUG";
 
+	// Stat before reading, a change while we compile must not go unnoticed
+	_cppipe::stat_dependency(fs::canonical(src_file).c_str(), src_dep);
+
+	// File to preprocess
+	MappedFile src = mapfile_for_writing(src_file);
+
+	// The directives can define macros and include paths
+	parse_directives(string_view(src.data, src.len));
+	for(const string& flag: directive_flags)
+		preprocess += flag.c_str();
+
 	// Read source from stdin
 	preprocess += "-";
 
@@ -297,9 +1095,6 @@ bool preprocess_and_compare()
 
 	Proc preprocessing = detachRedirInOut(preprocess);
 
-	// File to preprocess
-	MappedFile src = mapfile_for_writing(src_file);
-
 	// If it begins with #! skip the first line
 	const char* p = src.data;
 	if(src.len > 1 && p[0] == '#' && p[1] == '!')
@@ -315,87 +1110,724 @@ bool preprocess_and_compare()
 	if( !wait(preprocessing) )	// preprocessing failed
 		exit(1);
 
-	if( fs::exists(preprocessed_file) ) // todo: clean up if else blocks
+	src_system_headers.clear();
+	src_includes = _cppipe::included_files(new_pp, &src_system_headers);
+
+	// Comments are dropped by the preprocessor, keep the directives so changing them recompiles
+	new_pp += directives;
+	pp_hash = _cppipe::hash_bytes(new_pp);
+
+	_cppipe::TraceSpan compare_span("compare");
+
+	error_code ec;
+	if( fs::file_size(preprocessed_file, ec) == new_pp.size() && !new_pp.empty() )
 	{
-		if( fs::file_size(preprocessed_file) == new_pp.size() )
-		{
-			MappedFile old_pp = mapfile_for_writing(preprocessed_file);
-			if( !memcmp(old_pp.data, new_pp.data(), old_pp.len) ) // unchanged
-			{
-				return false;
-			}
-			else
-			{
-				memcpy(old_pp.data, &new_pp[0], old_pp.len);
-				munmap(old_pp.data, old_pp.len);
-				return true;
+		MappedFile old_pp = mapfile_for_writing(preprocessed_file);
+		bool unchanged = !memcmp(old_pp.data, new_pp.data(), old_pp.len);
+		munmap(old_pp.data, old_pp.len);
+
+		if(unchanged)
+			return false;
+	}
+
+	replace_file(preprocessed_file, new_pp);
+	return true;
+}
+
+void replace_file(const fs::path& file, string_view content)
+{
+	if(!_cppipe::write_atomically(file, content))
+	{
+		cerr << "ERROR: Couldn't write " << file << ' ' << strerror(errno) << '\n';
+		exit(1);
+	}
+}
+
+fd_t lock_cache_entry()
+{
+	_cppipe::TraceSpan span("lock");
+
+	const string lock_path = bin.string() + ".lock";
+	fd_t fd = open(lock_path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+	if(fd == -1 || flock(fd, LOCK_EX) == -1)
+	{
+		cerr << "ERROR: Couldn't lock " << lock_path << ' ' << strerror(errno) << '\n';
+		exit(1);
+	}
+	return fd;
+}
+
+void parse_directives(string_view src)
+{
+	const fs::path src_dir = fs::canonical(src_file).parent_path();
+	const string_view prefix = "// cppipe:";
+
+	for(size_t begin = 0, end; begin < src.size(); begin = end + 1)
+	{
+		end = src.find('\n', begin);
+		if(end == string_view::npos)
+			end = src.size();
+
+		string_view line = src.substr(begin, end - begin);
+		size_t start = line.find_first_not_of(" \t");
+		if(start == string_view::npos || line.compare(start, prefix.size(), prefix))
+			continue;
+
+		directives += line;
+		directives += '\n';
+
+		// KEY=VALUE,VALUE... separated by whitespace
+		line.remove_prefix(start + prefix.size());
+		while(!line.empty())
+		{
+			size_t word_begin = line.find_first_not_of(" \t\r");
+			if(word_begin == string_view::npos)
+				break;
+			size_t word_end = line.find_first_of(" \t\r", word_begin);
+			string_view word = line.substr(word_begin, word_end - word_begin);
+			line.remove_prefix(word_end == string_view::npos ? line.size() : word_end);
+
+			size_t eq = word.find('=');
+			string_view key = word.substr(0, eq);
+			vector<string>* values;
+			if(key == "sources")
+				values = &directive_sources;
+			else if(key == "link")
+				values = &directive_libs;
+			else if(key == "flags")
+				values = &directive_flags;
+			else
+			{
+				cerr << "ERROR: Unknown directive \"" << word << "\" in " << src_file << '\n';
+				exit(1);
+			}
+
+			for(size_t v = eq == string_view::npos ? word.size() : eq + 1, comma; v < word.size(); v = comma + 1)
+			{
+				comma = word.find(',', v);
+				if(comma == string_view::npos)
+					comma = word.size();
+				string_view value = word.substr(v, comma - v);
+				if(value.empty())
+					continue;
+
+				if(values == &directive_sources)	// relative to the src
+					values->push_back(src_dir / value);
+				else if(values == &directive_libs)
+					values->push_back("-l" + string(value));
+				else
+					values->emplace_back(value);
 			}
-			// todo
-			// munmap(data, len);
 		}
+	}
+}
+
+bool build_objects()
+{
+	using namespace _cppipe;
+
+	if(directive_sources.empty())
+		return false;
+
+	_cppipe::TraceSpan span("objects");
+
+	const fs::path objs_dir = bin.string() + ".objs";
+	error_code ec;
+	fs::create_directories(objs_dir, ec);
+
+	// Objects of the same source built with other flags get other names
+	U64 flags_hash = hash_bytes(debug ? DEBUG_PREFIX : "");
+	flags_hash = hash_bytes(string_view(shared_lib ? ".so" : ""), flags_hash);
+	for(const string& flag: directive_flags)
+		flags_hash = hash_bytes(flag.c_str(), flag.size() + 1, flags_hash);
+	for(const char* arg: additional_compiler_args)
+		flags_hash = hash_bytes(arg, strlen(arg) + 1, flags_hash);
+
+	vector<string> depfiles, tmp_objs;
+	for(const string& source: directive_sources)
+	{
+		const string name = fs::path(source).stem().string() + '-'
+			+ to_hex(hash_bytes(source, flags_hash));
+		objects.push_back((objs_dir / name += ".o").string());
+		depfiles.push_back((objs_dir / name += ".d").string());
+		tmp_objs.push_back(objects.back() + ".tmp" + to_string(getpid()));
+	}
+
+	// Like make, an object is stale if a file it was compiled from is newer
+	vector<size_t> stale;
+	for(size_t i = 0; i < objects.size(); ++i)
+	{
+		vector<string> deps;
+		struct stat obj_st, st;
+		bool fresh = stat(objects[i].c_str(), &obj_st) == 0 && read_depfile(depfiles[i], deps);
+		for(size_t d = 0; fresh && d < deps.size(); ++d)
+		{
+			fresh = stat(deps[d].c_str(), &st) == 0
+				&& (st.st_mtim.tv_sec < obj_st.st_mtim.tv_sec
+				    || (st.st_mtim.tv_sec == obj_st.st_mtim.tv_sec && st.st_mtim.tv_nsec <= obj_st.st_mtim.tv_nsec));
+		}
+
+		if(!fresh)
+			stale.push_back(i);
+	}
+
+	// Compile the stale ones at once, then wait for all of them
+	vector<Proc> compiling;
+	for(size_t i: stale)
+	{
+		const SrcType type = find_src_type(directive_sources[i]);
+		Cmd compile(type == SrcType::C ? CC : CXX, "-c", "-o", tmp_objs[i].c_str(),
+		            "-MMD", "-MF", depfiles[i].c_str());
+		append_language_flags(compile, type, false);
+		if(debug)
+			compile.append_args({ DEBUG_FLAGS });
 		else
+			compile.append_args({ RELEASE_FLAGS, "-DNDEBUG" });
+		if(shared_lib)
+			compile += "-fPIC";
+		for(const string& flag: directive_flags)
+			compile += flag.c_str();
+		for(const char* arg: additional_compiler_args)
+			compile += arg;
+		if(type == SrcType::CPP)
+			compile += "-xc++";
+		compile += directive_sources[i].c_str();
+
+		compiling.push_back(detach(compile));
+	}
+
+	bool failed = false;
+	for(size_t n = 0; n < stale.size(); ++n)
+	{
+		const size_t i = stale[n];
+		if( !wait(compiling[n]) || rename(tmp_objs[i].c_str(), objects[i].c_str()) == -1 )
 		{
-			ofstream pp_file(preprocessed_file);
-			pp_file << new_pp;
-			return true;
+			unlink(tmp_objs[i].c_str());
+			unlink(depfiles[i].c_str());
+			failed = true;
 		}
 	}
-	else
+	if(failed)
+		exit(1);
+
+	// Objects of removed sources or old flags
+	for(auto it = fs::directory_iterator(objs_dir, ec); it != fs::directory_iterator(); it.increment(ec))
 	{
-		ofstream pp_file(preprocessed_file);
-		pp_file << new_pp;
-		return true;
+		const string path = it->path();
+		if(find(objects.begin(), objects.end(), path) == objects.end()
+		   && find(depfiles.begin(), depfiles.end(), path) == depfiles.end())
+			unlink(path.c_str());
+	}
+
+	for(const string& depfile: depfiles)
+		read_depfile(depfile, object_deps);
+
+	return !stale.empty();
+}
+
+bool read_depfile(const string& depfile, vector<string>& deps)
+{
+	fd_t fd = open(depfile.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd == -1)
+		return false;
+	const string text = read_to_end(fd);
+	close(fd);
+
+	// OBJECT: DEP DEP... with lines continued by a backslash
+	size_t colon = text.find(": ");
+	if(colon == string::npos)
+		return false;
+
+	string dep;
+	for(size_t i = colon + 2; i <= text.size(); ++i)
+	{
+		const char c = i < text.size() ? text[i] : '\n';
+		if(c == '\\' && i + 1 < text.size() && text[i+1] != '\n')	// escaped space
+		{
+			dep += text[++i];
+		}
+		else if(c == '\\' || c == ' ' || c == '\t' || c == '\n')
+		{
+			if(!dep.empty())
+				deps.push_back(fs::absolute(dep));
+			dep.clear();
+		}
+		else
+		{
+			dep += c;
+		}
 	}
+	return true;
+}
+
+void append_language_flags(Cmd& cmd, SrcType type, bool whole_program)
+{
+	static const char* const c_flags[] = { CFLAGS, nullptr };
+	static const char* const cxx_flags[] = { CXXFLAGS, nullptr };
+
+	// Other translation units can't be linked to a whole program
+	for(const char* const* flag = type == SrcType::C ? c_flags : cxx_flags; *flag; ++flag)
+	{
+		if(whole_program || strcmp(*flag, "-fwhole-program"))
+			cmd += *flag;
+	}
+
+	if(!march.empty())
+		cmd += march.c_str();
 }
 
 void compile_src_file()
 {
+	using namespace _cppipe;
+
 	if(quick)
 	{
 		error_code ec;
 		if(fs::last_write_time(src_file) < fs::last_write_time(bin, ec))
 		{
 			// Binary is newer then source, don't recompile
+			cache_result = HIT;
 			return;
 		}
 	}
 
-	bool file_changed = preprocess_and_compare();
+	// When many cppipes start a changed src at once, one compiles and the rest wait
+	fd_t lock = lock_cache_entry();
 
-	// Only compile if the source is newer then the bin
-	if(file_changed || !fs::exists(bin))
+	// Another cppipe may have updated the binary while we waited
+	Stamp stamp;
+	const bool have_stamp = stamp.read((bin.string() + ".stamp").c_str()) && stamp.bin == bin.string();
+	bin_tier = have_stamp ? stamp.tier : TIER_OPTIMIZED;
+	if(have_stamp && stamp.fresh() && tier_acceptable(bin_tier))
 	{
-		Cmd compile(
-			src_type == SrcType::C ? CC : CXX,
-			preprocessed_file.c_str(),
-			"-o", bin.c_str()
-			);
+		cache_result = HIT;
+		link_index();
+
+		// Enough training runs, or the previous background build died,
+		// a run that went past exec_if_cached was counted there already
+		pp_hash = stamp.hash;
+		if(bin_tier == TIER_PGO_TRAINING && !training_runs)
+			training_runs = count_training_run(bin);
+		const bool rebuild = bin_tier == TIER_QUICK
+			|| (bin_tier == TIER_PGO_TRAINING && training_runs > PGO_TRAINING_RUNS);
+
+		// The background build links the objects and libs of the directives, a hit didn't read them
+		if(rebuild)
+		{
+			MappedFile src = mapfile_for_writing(src_file);
+			parse_directives(string_view(src.data, src.len));
+			munmap(src.data, src.len);
+			build_objects();
+		}
+		close(lock);	// before the fork, the background process would hold it
 
+		if(rebuild)
+			start_background_build();
+		return;
+	}
 
-		if(src_type == SrcType::C)
-			compile.append_args({ CFLAGS });
-		else
-			compile.append_args({ CXXFLAGS });
+	I64 begin = _cppipe::now_us();
+	bool file_changed = preprocess_and_compare();
+	add_phase_time(PREPROCESS, begin);
+	cache_result = COMPARE_HIT;
 
+	begin = _cppipe::now_us();
+	bool objects_changed = build_objects();
+	if(objects_changed)
+	{
+		add_phase_time(COMPILE, begin);
+		cache_result = COMPILED;
+	}
 
-		// Remap the debug source file since we compile from stdin
-		string debug_remap = "-fdebug-prefix-map=<stdin>=" + src_file.string();
+	// Only compile if the source is newer then the bin, an object was recompiled,
+	// or if the tier of the bin is not good enough e.g. a quick build without -t
+	if(file_changed || objects_changed || !fs::exists(bin) || !tier_acceptable(bin_tier))
+	{
 		if(debug)
-			compile.append_args({ DEBUG_FLAGS, debug_remap.c_str() });
+			bin_tier = TIER_OPTIMIZED;
+		else if(pgo)
+			bin_tier = TIER_PGO_TRAINING;
+		else if(tiered && !dont_run)
+			bin_tier = TIER_QUICK;
 		else
-			compile.append_args({ RELEASE_FLAGS });
+			bin_tier = TIER_OPTIMIZED;
 
-		for(const char* arg: additional_compiler_args)
-			compile += arg;
+		// A profile is only valid for the preprocessed source it was collected from,
+		// compile that from a copy that stays at the same path for the PGO_USE_FLAGS build
+		string input = preprocessed_file;
+		if(bin_tier == TIER_PGO_TRAINING)
+		{
+			error_code ec;
+			fs::remove_all(pgo_dir, ec);
+			fs::create_directories(pgo_dir, ec);
+			input = (pgo_dir / "src" += preprocessed_file.extension()).string();
+			fs::copy_file(preprocessed_file, input, ec);
+		}
 
-		if( !compile() )	 // if failed to compile
+		// Compile next to the bin and rename, a running cppipe never execs a partial binary
+		const string tmp_bin = bin.string() + ".tmp" + to_string(getpid());
+		Cmd compile = compile_command(input.c_str(), tmp_bin.c_str(), bin_tier);
+
+		_cppipe::TraceSpan span("compile");
+		begin = _cppipe::now_us();
+		if( !compile() || rename(tmp_bin.c_str(), bin.c_str()) == -1 ) // if failed to compile
 		{
+			fs::remove(tmp_bin);
 			fs::remove(bin);
 			exit(1);
 		}
+		add_phase_time(COMPILE, begin);
+		cache_result = COMPILED;
+	}
+
+	update_stamp();
+	close(lock);
+
+	if(bin_tier == TIER_QUICK)
+		start_background_build();
+
+	// Trim the cache when we have paid for a compile anyway, never on a hit
+	if(cache_result == COMPILED)
+		maybe_collect_garbage();
+}
+
+bool tier_acceptable(int tier)
+{
+	using namespace _cppipe;
+	switch(tier)
+	{
+	case TIER_QUICK:
+		return tiered && !debug && !dont_run;
+	case TIER_PGO_TRAINING:
+		return pgo;
+	default:
+		return true;
 	}
 }
 
+Cmd compile_command(const char* in, const char* out, int tier)
+{
+	using namespace _cppipe;
+
+	Cmd compile(
+		src_type == SrcType::C ? CC : CXX,
+		in,
+		"-o", out
+		);
+
+
+	// main stays exported from a shared object, for call() to find
+	append_language_flags(compile, src_type, objects.empty() && !shared_lib);
+	if(shared_lib)
+		compile.append_args({ SHARED_FLAGS });
+
+	// Remap the debug source file since we compile from stdin
+	debug_remap = "-fdebug-prefix-map=<stdin>=" + src_file.string();
+	if(debug)
+		compile.append_args({ DEBUG_FLAGS, debug_remap.c_str() });
+	else if(tier == TIER_QUICK)
+		compile.append_args({ TIER0_FLAGS });
+	else
+		compile.append_args({ RELEASE_FLAGS });
+
+	// The profile is named after -dumpbase, which is otherwise taken from the output
+	pgo_dumpbase = (pgo_dir / "profile").string();
+	if(tier == TIER_PGO_TRAINING)
+		compile.append_args({ PGO_GENERATE_FLAGS, "-dumpbase", pgo_dumpbase.c_str() });
+	else if(tier == TIER_PGO_OPTIMIZED)
+		compile.append_args({ PGO_USE_FLAGS, "-dumpbase", pgo_dumpbase.c_str() });
+
+	for(const string& flag: directive_flags)
+		compile += flag.c_str();
+	for(const char* arg: additional_compiler_args)
+		compile += arg;
+
+	// Libraries after everything that uses them
+	for(const string& object: objects)
+		compile += object.c_str();
+	for(const string& lib: directive_libs)
+		compile += lib.c_str();
+
+	return compile;
+}
+
+void start_background_build()
+{
+	using namespace _cppipe;
+
+	// One background build per entry
+	const string build_lock = bin.string() + ".build.lock";
+	fd_t lock = open(build_lock.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+	if(lock == -1 || flock(lock, LOCK_EX | LOCK_NB) == -1)
+	{
+		close(lock);
+		return;
+	}
+
+	const int from_tier = bin_tier;
+	const int to_tier = from_tier == TIER_QUICK ? TIER_OPTIMIZED : TIER_PGO_OPTIMIZED;
+	const string pid = to_string(getpid());
+	const string tmp_bin = bin.string() + ".build-" + pid;
+
+	// The profile guided build uses the copy in pgo_dir,
+	// else a link keeps the preprocessed source even if a newer one replaces it
+	string pp = (pgo_dir / "src" += preprocessed_file.extension()).string();
+	if(from_tier == TIER_QUICK)
+	{
+		pp = preprocessed_file.string() + ".build-" + pid + preprocessed_file.extension().string();
+		unlink(pp.c_str());
+		if(link(preprocessed_file.c_str(), pp.c_str()) == -1)
+		{
+			close(lock);
+			return;
+		}
+	}
+
+	if(!fork_detached())
+	{
+		close(lock);	// the background process holds it now
+		return;
+	}
+
+	bool compiled = bool( compile_command(pp.c_str(), tmp_bin.c_str(), to_tier)() );
+	if(from_tier == TIER_QUICK)
+		unlink(pp.c_str());
+
+	if(compiled)
+	{
+		// Only replace the binary we started from, the src may have changed since
+		fd_t entry_lock = lock_cache_entry();
+		const string stamp_path = bin.string() + ".stamp";
+		Stamp stamp;
+		if(stamp.read(stamp_path.c_str()) && stamp.bin == bin.string()
+		   && stamp.tier == from_tier && stamp.hash == pp_hash
+		   && rename(tmp_bin.c_str(), bin.c_str()) == 0)
+		{
+			stamp.tier = to_tier;
+			stamp.write(stamp_path.c_str());
+
+			// The profile has served its purpose
+			if(from_tier == TIER_PGO_TRAINING)
+			{
+				error_code ec;
+				fs::remove_all(pgo_dir, ec);
+			}
+		}
+		close(entry_lock);
+	}
+
+	unlink(tmp_bin.c_str());
+	unlink(build_lock.c_str());
+	_exit(0);
+}
+
+I64 count_training_run(const string& bin)
+{
+	// One byte per run, appends from concurrent runs don't get lost
+	const string runs = bin + ".pgo/runs";
+	fd_t fd = open(runs.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	struct stat st;
+	if(fd == -1 || write(fd, "", 1) != 1 || fstat(fd, &st) == -1)
+	{
+		close(fd);
+		return 0;
+	}
+	close(fd);
+	return st.st_size;
+}
+
+bool fork_detached()
+{
+	cout.flush();
+	cerr.flush();
+
+	// Fork twice, the middle process exits right away
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		if(fork() == 0)
+		{
+			setsid();
+			fd_t null = open("/dev/null", O_RDWR | O_CLOEXEC);
+			dup2(null, STDIN_FILENO);
+			dup2(null, STDOUT_FILENO);
+			dup2(null, STDERR_FILENO);
+			return true;
+		}
+		_exit(0);
+	}
+	if(pid != -1)
+		waitpid(pid, nullptr, 0);
+	return false;
+}
+
+int export_binary(string_view src_arg)
+{
+	march = export_march;
+	init_context(src_arg);
+
+	// Build in a directory of our own, the cache entry stays as it is
+	char tmp_dir[] = "/tmp/cppipe-export-XXXXXX";
+	if(!mkdtemp(tmp_dir))
+	{
+		cerr << "ERROR: Couldn't create a directory in /tmp " << strerror(errno) << '\n';
+		return 1;
+	}
+	preprocessed_file = fs::path(tmp_dir) / preprocessed_file.filename();
+	bin = fs::path(tmp_dir) / bin.filename();
+
+	// Objects need -flto as well, directive_flags go to every compile
+	if(export_lto)
+		directive_flags.insert(directive_flags.end(), { EXPORT_LTO_FLAGS });
+	if(export_static)
+		directive_flags.insert(directive_flags.end(), { EXPORT_STATIC_FLAGS });
+
+	preprocess_and_compare();
+	build_objects();
+
+	const string tmp_out = string(export_path) + ".tmp" + to_string(getpid());
+	Cmd compile = compile_command(preprocessed_file.c_str(), tmp_out.c_str(), _cppipe::TIER_OPTIMIZED);
+
+	// Where the binary came from, read with: readelf -p .cppipe_manifest OUT
+	string manifest = "source " + abs_src + '\n'
+		+ "source_hash " + _cppipe::to_hex(pp_hash) + '\n'
+		+ "compiler " + $(Cmd(compile.argv[0], "--version") | Cmd("head", "-n1")) + '\n'
+		+ "flags";
+	for(size_t i = 1; i + 1 < compile.argv.size(); ++i)
+	{
+		string_view arg = compile.argv[i];
+		if(arg == "-o" || arg == tmp_out)
+			continue;
+		if(arg.substr(0, sizeof tmp_dir) == string(tmp_dir) + '/')	// the files we build from
+			arg.remove_prefix(sizeof tmp_dir);
+		manifest += ' ';
+		manifest += arg;
+	}
+	manifest += '\n';
+
+	{
+		fd_t fd = open(preprocessed_file.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+		const string var = "\nstatic const char cppipe_manifest[]"
+			" __attribute__((used, section(\".cppipe_manifest\"))) = "
+			+ c_string_literal(manifest) + ";\n";
+		if(fd == -1 || write(fd, var.data(), var.size()) != (ssize_t)var.size())
+		{
+			cerr << "ERROR: Couldn't write " << preprocessed_file << '\n';
+			exit(1);
+		}
+		close(fd);
+	}
+
+	bool compiled = bool( compile() ) && rename(tmp_out.c_str(), export_path) == 0;
+	unlink(tmp_out.c_str());
+
+	error_code ec;
+	fs::remove_all(tmp_dir, ec);
+
+	if(!compiled)
+		return 1;
+
+	cout << "Exported " << export_path << '\n';
+	return 0;
+}
+
+string c_string_literal(string_view text)
+{
+	string literal = "\"";
+	for(char c: text)
+	{
+		if(c == '"' || c == '\\')
+			literal += '\\';
+		if(c == '\n')
+			literal += "\\n";
+		else
+			literal += c;
+	}
+	return literal + '"';
+}
+
+void update_stamp()
+{
+	_cppipe::Stamp stamp;
+	stamp.bin = bin;
+	stamp.hash = pp_hash;
+	stamp.tier = bin_tier;
+	stamp.files.push_back(preprocessed_file);
+	if(bin_tier == _cppipe::TIER_PGO_TRAINING)
+	{
+		for(const char* file: { "/src.i", "/src.ii", "/profile-src.gcda", "/runs" })
+			stamp.files.push_back(pgo_dir.string() + file);
+	}
+	for(const string& object: objects)
+	{
+		stamp.files.push_back(object);
+		stamp.files.push_back(object.substr(0, object.size() - 2) + ".d");
+	}
+	stamp.deps.push_back(src_dep);
+	for(const string& file: src_includes)
+	{
+		// The src is preprocessed from stdin, its quoted includes are searched in the cwd
+		if(file[0] != '/')
+			stamp.cwd = fs::current_path();
+		_cppipe::Dependency dep;
+		if(_cppipe::stat_dependency(fs::absolute(file).c_str(), dep))
+			stamp.deps.push_back(move(dep));
+	}
+	// Package managers replace files by renaming, so the directories of the system headers
+	// change with them and a hit stats a few directories instead of every header
+	vector<string> dirs;
+	for(const string& file: src_system_headers)
+	{
+		const string dir = fs::path(file).parent_path();
+		_cppipe::Dependency dep;
+		if(find(dirs.begin(), dirs.end(), dir) == dirs.end() && _cppipe::stat_dependency(dir.c_str(), dep))
+		{
+			dirs.push_back(dir);
+			stamp.deps.push_back(move(dep));
+		}
+	}
+	// The index is keyed by the name of the compiler, an upgrade is found by its stat
+	struct stat compiler_stat;
+	const string compiler = _cppipe::find_compiler(src_type == SrcType::C ? CC : CXX, compiler_stat);
+	_cppipe::Dependency compiler_dep;
+	if(!compiler.empty() && _cppipe::stat_dependency(compiler.c_str(), compiler_dep))
+		stamp.deps.push_back(move(compiler_dep));
+	for(const string& file: object_deps)
+	{
+		_cppipe::Dependency dep;
+		bool known = false;
+		for(const _cppipe::Dependency& d: stamp.deps)
+			known = known || d.path == file;
+		if(!known && _cppipe::stat_dependency(file.c_str(), dep))
+			stamp.deps.push_back(move(dep));
+	}
+
+	const string stamp_path = bin.string() + ".stamp";
+	if(!stamp.write(stamp_path.c_str()))
+	{
+		cerr << "WARNING: Couldn't write " << stamp_path << '\n';
+		return;
+	}
+
+	link_index();
+}
+
+void link_index()
+{
+	const string stamp_path = bin.string() + ".stamp";
+	const string key = _cppipe::index_key(src_type == SrcType::C ? CC : CXX);
+	const fs::path index = _cppipe::index_path(_cppipe::cache_root(), abs_src,
+	                                              (debug ? DEBUG_PREFIX + key : key) + args_variant());
+
+	error_code ec;
+	fs::create_directories(index.parent_path(), ec);
+
+	// Point the index at the stamp, replace the old link atomically
+	const string tmp = index.string() + ".tmp" + to_string(getpid());
+	if(symlink(stamp_path.c_str(), tmp.c_str()) == -1 || rename(tmp.c_str(), index.c_str()) == -1)
+		unlink(tmp.c_str());
+}
+
 void print_usage()
 {
 	cout << "Usage: cppipe [OPTION]... FILE [ARGUMENT]...\n";
@@ -420,4 +1852,297 @@ SrcType find_src_type(const string_view p)
 	}
 }
 
+void record_stats()
+{
+	static const char* const phase_names[PHASE_COUNT] = { "find", "cache_dir", "preprocess", "compile" };
+	static const char* const result_names[] = { "hit", "compare-hit", "compile" };
+
+	// Totals of all recorded runs, kept as "name value" lines
+	I64 runs[3] = {};
+	I64 total_us[PHASE_COUNT] = {};
+
+	const fs::path stats_path = fs::path(_cppipe::cache_root()) / STATS_FILE;
+	fd_t fd = open(stats_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd == -1)
+	{
+		cerr << "WARNING: Can't open " << stats_path << ' ' << strerror(errno) << '\n';
+		return;
+	}
+	flock(fd, LOCK_EX);	// concurrent runs update the same file
+
+	string old;
+	char buf[512];
+	for(ssize_t n; (n = read(fd, buf, sizeof buf)) > 0; )
+		old.append(buf, n);
+
+	for(size_t begin = 0, end; begin < old.size(); begin = end + 1)
+	{
+		end = old.find('\n', begin);
+		if(end == string::npos)
+			end = old.size();
+
+		const string_view line = string_view(old).substr(begin, end - begin);
+		const size_t space = line.find(' ');
+		if(space == string::npos)
+			continue;
+
+		const string_view name = line.substr(0, space);
+		const I64 value = atoll(string(line.substr(space + 1)).c_str());
+		for(int i = 0; i < 3; ++i)
+			if(name == string("runs_") + result_names[i])
+				runs[i] = value;
+		for(int i = 0; i < PHASE_COUNT; ++i)
+			if(name == string("us_") + phase_names[i])
+				total_us[i] = value;
+	}
+
+	++runs[cache_result];
+	for(int i = 0; i < PHASE_COUNT; ++i)
+		total_us[i] += phase_us[i];
+
+	string updated;
+	for(int i = 0; i < 3; ++i)
+		updated += string("runs_") + result_names[i] + ' ' + to_string(runs[i]) + '\n';
+	for(int i = 0; i < PHASE_COUNT; ++i)
+		updated += string("us_") + phase_names[i] + ' ' + to_string(total_us[i]) + '\n';
+
+	pwrite(fd, updated.data(), updated.size(), 0);
+	ftruncate(fd, updated.size());
+	close(fd);		// releases the lock
+
+	if(!print_stats)
+		return;
+
+	// Report to stderr to keep the output of the program clean
+	I64 total = 0;
+	cerr << "cppipe: " << result_names[cache_result] << '\n';
+	for(int i = 0; i < PHASE_COUNT; ++i)
+	{
+		cerr << "  " << phase_names[i] << ' ' << phase_us[i] / 1000.0 << " ms\n";
+		total += phase_us[i];
+	}
+	cerr << "  total " << total / 1000.0 << " ms\n";
+
+	// Phases are averaged over the runs that went through them
+	const I64 all_runs = runs[HIT] + runs[COMPARE_HIT] + runs[COMPILED];
+	const I64 phase_runs[PHASE_COUNT] = { all_runs, all_runs, runs[COMPARE_HIT] + runs[COMPILED], runs[COMPILED] };
+
+	cerr << "cppipe: " << all_runs << " runs recorded in " << stats_path << '\n';
+	for(int i = 0; i < 3; ++i)
+		cerr << "  " << result_names[i] << ' ' << runs[i] << '\n';
+	for(int i = 0; i < PHASE_COUNT; ++i)
+		if(phase_runs[i])
+			cerr << "  mean " << phase_names[i] << ' ' << total_us[i] / 1000.0 / phase_runs[i] << " ms\n";
+}
+
+// A group of cache files that are removed together
+struct CacheEntry
+{
+	vector<string> files;
+	string lock;		// held while removing, the entry isn't removed if it's busy
+	I64 used;		// seconds since the epoch
+	I64 size;
+	bool orphan;		// the source is gone
+};
+
+// limit from the environment or from config.h
+I64 cache_limit(const char* env, I64 config_value)
+{
+	const char* value = getenv(env);
+	return value ? atoll(value) : config_value;
+}
+
+// whether path is a FILE.tmpPID or FILE.build-PID... that a live process is writing
+bool written_by_live_process(const string& path)
+{
+	const size_t slash = path.rfind('/') + 1;
+	for(const char* mark: { ".tmp", ".build-" })
+	{
+		const size_t at = path.find(mark, slash);
+		if(at == string::npos)
+			continue;
+
+		const char* digits = path.c_str() + at + strlen(mark);
+		char* end;
+		const long pid = strtol(digits, &end, 10);
+		if(end != digits && (!*end || *end == '.') && pid > 0
+		   && (kill(pid, 0) == 0 || errno == EPERM))
+			return true;
+	}
+	return false;
+}
+
+void collect_garbage(bool verbose)
+{
+	const fs::path root = _cppipe::cache_root();
+	const fs::path index_dir = root / ".index";
+	error_code ec;
+	fs::create_directories(root, ec);
+
+	// One collection at a time is enough
+	const fs::path gc_file = root / GC_FILE;
+	fd_t gc_lock = open(gc_file.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+	if(gc_lock == -1 || flock(gc_lock, LOCK_EX | LOCK_NB) == -1)
+	{
+		if(verbose)
+			cerr << "cppipe: the cache is already being cleaned\n";
+		return;
+	}
+	futimens(gc_lock, nullptr);
+
+	const I64 max_size = cache_limit("CPPIPE_CACHE_MAX_SIZE", CACHE_MAX_SIZE_MB) * 1024 * 1024;
+	const I64 max_age = cache_limit("CPPIPE_CACHE_MAX_AGE", CACHE_MAX_AGE_DAYS) * 24 * 60 * 60;
+	const I64 now = time(nullptr);
+
+	// All files in the cache except cppipe's own at the root
+	struct FileInfo
+	{
+		I64 size;
+		I64 mtime;
+		bool claimed;	// part of an entry
+	};
+	unordered_map<string, FileInfo> files;
+	vector<fs::path> dirs;
+
+	for(auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, ec);
+	    it != fs::recursive_directory_iterator();
+	    it.increment(ec))
+	{
+		const fs::path& path = it->path();
+		struct stat st;
+		if(path == index_dir || lstat(path.c_str(), &st) == -1)
+		{
+			it.disable_recursion_pending();
+			continue;
+		}
+
+		if(S_ISDIR(st.st_mode))
+			dirs.push_back(path);
+		else if(S_ISREG(st.st_mode) && !(path.parent_path() == root && path.filename().c_str()[0] == '.'))
+			files[path] = { st.st_size, st.st_mtime, false };
+	}
+
+	// Stamps tell which files belong together and when they were used
+	vector<CacheEntry> entries;
+	for(auto& [path, info]: files)
+	{
+		if(path.size() < 6 || path.compare(path.size() - 6, 6, ".stamp"))
+			continue;
+
+		_cppipe::Stamp stamp;
+		if(!stamp.read(path.c_str()))
+			continue;	// left as a loose file
+
+		struct stat st;
+		CacheEntry entry{ {}, stamp.bin + ".lock", stamp.used, 0,
+		                  stat(stamp.deps[0].path.c_str(), &st) == -1 };
+
+		vector<string> members = stamp.files;
+		members.insert(members.end(), { path, stamp.bin, entry.lock, stamp.bin + ".build.lock" });
+		for(const string& member: members)
+		{
+			auto file = files.find(member);
+			if(file != files.end() && !file->second.claimed)
+			{
+				file->second.claimed = true;
+				entry.files.push_back(member);
+				entry.size += file->second.size;
+			}
+		}
+		entries.push_back(move(entry));
+	}
+
+	// The rest are on their own, e.g. left by a compile that failed or an older cppipe
+	for(auto& [path, info]: files)
+	{
+		// Temporary files of a build that is still running, a later collection gets them if it died
+		if(info.claimed || written_by_live_process(path))
+			continue;
+
+		const bool is_lock = path.size() > 5 && !path.compare(path.size() - 5, 5, ".lock");
+		entries.push_back({ { path }, is_lock ? path : "", info.mtime, info.size, false });
+	}
+
+	// Orphans first, then the least recently used
+	sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b)
+	{
+		return a.orphan != b.orphan ? a.orphan : a.used < b.used;
+	});
+
+	I64 total = 0;
+	for(const CacheEntry& entry: entries)
+		total += entry.size;
+
+	int removed = 0, orphans = 0;
+	I64 removed_size = 0;
+	for(const CacheEntry& entry: entries)
+	{
+		if(!entry.orphan
+		   && !(max_age && now - entry.used > max_age)
+		   && !(max_size && total > max_size))
+			continue;
+
+		// Don't pull the files from under a cppipe that is compiling them
+		fd_t lock = -1;
+		if(!entry.lock.empty())
+		{
+			lock = open(entry.lock.c_str(), O_RDONLY | O_CLOEXEC);
+			if(lock != -1 && flock(lock, LOCK_EX | LOCK_NB) == -1)
+			{
+				close(lock);
+				continue;
+			}
+		}
+
+		for(const string& file: entry.files)
+			unlink(file.c_str());
+		if(lock != -1)
+			close(lock);
+
+		total -= entry.size;
+		removed_size += entry.size;
+		++removed;
+		orphans += entry.orphan;
+	}
+
+	// Index links to removed stamps
+	for(auto it = fs::directory_iterator(index_dir, ec); it != fs::directory_iterator(); it.increment(ec))
+	{
+		struct stat st;
+		if(stat(it->path().c_str(), &st) == -1)
+			unlink(it->path().c_str());
+	}
+
+	// Directories left empty, deepest first
+	sort(dirs.begin(), dirs.end(), [](const fs::path& a, const fs::path& b)
+	{
+		return a.native().size() > b.native().size();
+	});
+	for(const fs::path& dir: dirs)
+		rmdir(dir.c_str());
+
+	close(gc_lock);
+
+	if(verbose)
+	{
+		cout << "Removed " << removed << " cache entries (" << orphans << " of deleted sources), "
+		     << removed_size / 1024 << " KiB\n"
+		     << "Cache size: " << total / 1024 << " KiB\n";
+	}
+}
+
+void maybe_collect_garbage()
+{
+	struct stat st;
+	const string gc_file = _cppipe::cache_root() + '/' + GC_FILE;
+	if(stat(gc_file.c_str(), &st) == 0 && time(nullptr) - st.st_mtime < GC_INTERVAL)
+		return;
+
+	if(fork_detached())
+	{
+		collect_garbage(false);
+		_exit(0);
+	}
+}
+
 }
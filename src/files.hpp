@@ -0,0 +1,81 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include "commands.hpp"
+
+/* Listing files without find or ls
+
+   The directories are read with getdents64 by a pool of threads, each takes
+   the subdirectories it finds and the idle ones steal from the others, so
+   big trees are walked on all cores without a process or parsing its output.
+
+   shell:
+       find src -name '*.c' | xargs wc -l
+   becomes:
+       auto srcs = walk("src", [](const std::string& path, unsigned char type)
+                        { return type == DT_REG && path.size() > 2 && !path.compare(path.size() - 2, 2, ".c"); });
+       run_batched(Cmd("wc", "-l"), srcs);
+
+   On glibc older than 2.34 link with -pthread: // cppipe: link=pthread
+*/
+
+// In line comments, a src/*.c in a block comment warns with -Wcomment
+// shell:
+//     cc -c src/*.c
+// becomes:
+//     auto srcs = glob("src/*.c");
+//     Cmd cc("cc", "-c");
+//     cc.append_args(srcs);
+//     cc();
+
+/* Whether walk() lists an entry, type is a DT_ constant of <dirent.h> e.g. DT_REG, DT_DIR, DT_LNK
+ * It is called by many threads at once */
+using WalkFilter = std::function<bool(const std::string& path, unsigned char type)>;
+
+/* The paths under root at any depth that the filter accepts, all of them without one,
+ * like find ROOT -mindepth 1, in no particular order
+ * Symlinks to directories are not followed, threads is the number of threads, all cores if 0 */
+std::vector<std::string> walk(const char* root, const WalkFilter& = nullptr, int threads = 0);
+
+/* The paths that match the pattern sorted, none if nothing matches
+ * *, ? and [...] match within a file name, a ** component matches any number of directories
+ * Names that begin with '.' are only matched by a '.' in the pattern, like in the shell */
+std::vector<std::string> glob(const char* pattern, int threads = 0);
+
+/* Run the command with the args appended, split in as many runs as the command line
+ * length limit needs, like xargs, up to jobs runs at once
+ * Nothing is run without args, return whether all the runs succeeded */
+bool run_batched(const Cmd&, const std::vector<std::string>& args, int jobs = 1);
+
+namespace _cppipe
+{
+	/* Called for an entry found by walk_tree, worker is the index of the thread,
+	 * a directory is only walked if it returns true */
+	using WalkVisit = std::function<bool(const std::string& path, unsigned char type, int worker)>;
+
+	/* The number of threads to use for the threads argument */
+	int walk_threads(int threads);
+
+	/* Walk the tree under root with a pool of threads, "" is the current directory
+	 * Directories that can't be read are reported, the missing ones only if report_missing */
+	void walk_tree(const std::string& root, const WalkVisit&, int threads, bool report_missing = true);
+
+	/* The non empty components of a path */
+	std::vector<std::string> split_path(std::string_view path);
+
+	/* Move the lists of the workers into one */
+	std::vector<std::string> concat(std::vector<std::vector<std::string>>&);
+
+	/* Whether the path components match the pattern components,
+	 * or with prefix whether paths under them could */
+	bool glob_match(const std::vector<std::string>& pattern, size_t p,
+	                const std::vector<std::string>& path, size_t c, bool prefix);
+
+	/* Bytes of the arguments of a batch of run_batched */
+	enum : size_t { BATCH_BYTES = 128 * 1024 };
+}
+
+#include "files.inl"
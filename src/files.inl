@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "files.hpp"
+#include "trace.hpp"
+
+namespace _cppipe
+{
+	inline int walk_threads(int threads)
+	{
+		if(threads <= 0)
+			threads = std::thread::hardware_concurrency();
+		return threads > 0 ? threads : 1;
+	}
+
+	inline void walk_tree(const std::string& root, const WalkVisit& visit, int threads, bool report_missing)
+	{
+		struct Queue
+		{
+			std::mutex lock;
+			std::deque<std::string> dirs;
+		};
+		std::vector<Queue> queues(threads);
+		queues[0].dirs.push_back(root);
+		std::atomic<size_t> pending{ 1 };	/* directories queued or being read */
+
+		auto take = [&](int worker, std::string& dir)
+		{
+			/* Our newest directory, depth first keeps the queues short */
+			{
+				std::lock_guard<std::mutex> guard(queues[worker].lock);
+				if(!queues[worker].dirs.empty())
+				{
+					dir = std::move(queues[worker].dirs.back());
+					queues[worker].dirs.pop_back();
+					return true;
+				}
+			}
+
+			/* Steal the oldest directory of another worker, likely the biggest subtree */
+			for(int i = 1; i < threads; ++i)
+			{
+				Queue& queue = queues[(worker + i) % threads];
+				std::lock_guard<std::mutex> guard(queue.lock);
+				if(!queue.dirs.empty())
+				{
+					dir = std::move(queue.dirs.front());
+					queue.dirs.pop_front();
+					return true;
+				}
+			}
+			return false;
+		};
+
+		auto work = [&](int worker)
+		{
+			std::vector<char> buf(1 << 16);
+			std::string dir;
+			for(;;)
+			{
+				if(!take(worker, dir))
+				{
+					if(pending == 0)
+						return;
+					std::this_thread::sleep_for(std::chrono::microseconds(20));
+					continue;
+				}
+
+				fd_t fd = openat(AT_FDCWD, dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+				if(fd == -1)
+				{
+					if(report_missing || (errno != ENOENT && errno != ENOTDIR))
+						std::cerr << "Can't read: " << dir << ' ' << strerror(errno) << '\n';
+					--pending;
+					continue;
+				}
+
+				const std::string prefix = dir.empty() || dir.back() == '/' ? dir : dir + '/';
+				for(long n; (n = syscall(SYS_getdents64, fd, buf.data(), buf.size())) > 0; )
+				{
+					for(long offset = 0; offset < n; )
+					{
+						const dirent64* entry = (const dirent64*)(buf.data() + offset);
+						offset += entry->d_reclen;
+
+						const char* name = entry->d_name;
+						if(name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+							continue;
+
+						/* Some file systems don't tell the type */
+						unsigned char type = entry->d_type;
+						struct stat st;
+						if(type == DT_UNKNOWN && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+							type = IFTODT(st.st_mode);
+
+						std::string path = prefix + name;
+						if(visit(path, type, worker) && type == DT_DIR)
+						{
+							++pending;
+							std::lock_guard<std::mutex> guard(queues[worker].lock);
+							queues[worker].dirs.push_back(std::move(path));
+						}
+					}
+				}
+				close(fd);
+				--pending;	/* after its subdirectories were counted */
+			}
+		};
+
+		std::vector<std::thread> pool;
+		for(int worker = 1; worker < threads; ++worker)
+			pool.emplace_back(work, worker);
+		work(0);
+		for(std::thread& thread: pool)
+			thread.join();
+	}
+
+	inline std::vector<std::string> concat(std::vector<std::vector<std::string>>& lists)
+	{
+		size_t size = 0;
+		for(const auto& list: lists)
+			size += list.size();
+
+		std::vector<std::string> all;
+		all.reserve(size);
+		for(auto& list: lists)
+			std::move(list.begin(), list.end(), std::back_inserter(all));
+		return all;
+	}
+
+	inline bool glob_match(const std::vector<std::string>& pattern, size_t p,
+	                       const std::vector<std::string>& path, size_t c, bool prefix)
+	{
+		if(c == path.size())
+		{
+			if(prefix)
+				return p < pattern.size();
+			for(; p < pattern.size(); ++p)
+				if(pattern[p] != "**")
+					return false;
+			return true;
+		}
+		if(p == pattern.size())
+			return false;
+
+		if(pattern[p] == "**")
+			return glob_match(pattern, p + 1, path, c, prefix)
+				|| (path[c][0] != '.' && glob_match(pattern, p, path, c + 1, prefix));
+
+		return fnmatch(pattern[p].c_str(), path[c].c_str(), FNM_PERIOD) == 0
+			&& glob_match(pattern, p + 1, path, c + 1, prefix);
+	}
+
+	inline std::vector<std::string> split_path(std::string_view path)
+	{
+		std::vector<std::string> components;
+		for(size_t begin = 0, end; begin < path.size(); begin = end + 1)
+		{
+			end = path.find('/', begin);
+			if(end == std::string_view::npos)
+				end = path.size();
+			if(end != begin)
+				components.emplace_back(path.substr(begin, end - begin));
+		}
+		return components;
+	}
+}
+
+inline std::vector<std::string> walk(const char* root, const WalkFilter& filter, int threads)
+{
+	using namespace _cppipe;
+
+	TraceSpan span("walk");
+	if(tracing())
+		span.args.add("root", root);
+
+	threads = walk_threads(threads);
+	std::vector<std::vector<std::string>> found(threads);
+	walk_tree(root, [&](const std::string& path, unsigned char type, int worker)
+	{
+		if(!filter || filter(path, type))
+			found[worker].push_back(path);
+		return true;
+	}, threads);
+
+	return concat(found);
+}
+
+inline std::vector<std::string> glob(const char* pattern, int threads)
+{
+	using namespace _cppipe;
+
+	TraceSpan span("glob");
+	if(tracing())
+		span.args.add("pattern", pattern);
+
+	/* The components before the first wildcard name the directory to walk */
+	std::vector<std::string> components = split_path(pattern);
+	std::string base = pattern[0] == '/' ? "/" : "";
+	size_t first = 0;
+	for(; first < components.size() && components[first].find_first_of("*?[") == std::string::npos; ++first)
+	{
+		if(!base.empty() && base.back() != '/')
+			base += '/';
+		base += components[first];
+	}
+
+	std::vector<std::string> matches;
+	if(first == components.size())
+	{
+		struct stat st;
+		if(!components.empty() && lstat(pattern, &st) == 0)
+			matches.push_back(pattern);
+		return matches;
+	}
+	components.erase(components.begin(), components.begin() + first);
+
+	/* Only the directories that can lead to a match are read */
+	const size_t skip = base.empty() || base.back() == '/' ? base.size() : base.size() + 1;
+	threads = walk_threads(threads);
+	std::vector<std::vector<std::string>> found(threads);
+	walk_tree(base, [&](const std::string& path, unsigned char type, int worker)
+	{
+		const std::vector<std::string> relative = split_path(std::string_view(path).substr(skip));
+		if(glob_match(components, 0, relative, 0, false))
+			found[worker].push_back(path);
+		return type == DT_DIR && glob_match(components, 0, relative, 0, true);
+	}, threads, false);	/* like in the shell, a pattern under a missing directory matches nothing */
+
+	matches = concat(found);
+	std::sort(matches.begin(), matches.end());
+	return matches;
+}
+
+inline bool run_batched(const Cmd& cmd, const std::vector<std::string>& args, int jobs)
+{
+	size_t cmd_bytes = 0;
+	for(const char* const* arg = cmd.argv.data(); *arg; ++arg)
+		cmd_bytes += strlen(*arg) + 1 + sizeof(char*);
+
+	std::deque<Proc> running;
+	bool ok = true;
+	for(size_t next = 0; next < args.size(); )
+	{
+		/* At least one argument per run, however long */
+		Cmd batch = cmd;
+		batch.argv.pop_back();
+		size_t bytes = cmd_bytes;
+		do
+		{
+			bytes += args[next].size() + 1 + sizeof(char*);
+			batch.argv.push_back(args[next].c_str());
+			++next;
+		} while(next < args.size() && bytes + args[next].size() + 1 + sizeof(char*) <= _cppipe::BATCH_BYTES);
+		batch.argv.push_back(nullptr);
+
+		if(running.size() >= (size_t)std::max(jobs, 1))
+		{
+			ok = bool(wait(running.front())) && ok;
+			running.pop_front();
+		}
+		running.push_back(detach(batch));
+	}
+
+	for(Proc& proc: running)
+		ok = bool(wait(proc)) && ok;
+	return ok;
+}
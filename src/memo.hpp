@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "commands.hpp"
+
+/* Memoized commands
+
+   The stdout and exit status of a slow command that always gives the same
+   result for the same input, e.g. pkg-config or git rev-parse, are cached
+   under CACHE_ROOT/memo, so the next run of the script doesn't run it again.
+
+   A result is found by the arguments of the command, the current directory
+   and what is declared in a Memo:
+   auto libs = memo$(Cmd("pkg-config", "--libs", "gtk4"), Memo().env("PKG_CONFIG_PATH"));
+
+   The result of a pipeline is found by the arguments of all of its commands,
+   only the last one is skipped on a hit, the ones before it have already started
+*/
+
+/* What the result of a memoized command depends on
+   char* pointers are kept and used NOT COPIED */
+class Memo
+{
+public:
+	/* An environment variable */
+	Memo& env(const char* name);
+	/* An input file, a change of its mtime, size or inode makes a new result */
+	Memo& file(const char* path);
+	/* Seconds a result is used for, by default until an input changes */
+	Memo& ttl(I64 seconds);
+
+	std::vector<const char*> envs;
+	std::vector<const char*> files;
+	I64 max_age = 0;
+};
+
+/* Like $() but memoized, a cached result is returned without running anything */
+std::string memo$(const PendingCmd&, const Memo& = Memo());
+
+/* Like run() but memoized, a cached output is written to where the output of
+   the command goes and the cached exit status is returned */
+DeadProc memo_run(const PendingCmd&, const Memo& = Memo());
+
+#include "memo.inl"
@@ -0,0 +1,158 @@
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "memo.hpp"
+#include "cache.hpp"
+#include "trace.hpp"
+
+inline Memo& Memo::env(const char* name)
+{
+	envs.push_back(name);
+	return *this;
+}
+
+inline Memo& Memo::file(const char* path)
+{
+	files.push_back(path);
+	return *this;
+}
+
+inline Memo& Memo::ttl(I64 seconds)
+{
+	max_age = seconds;
+	return *this;
+}
+
+namespace _cppipe
+{
+	/* The file of a result: CACHE_ROOT/memo/HASH */
+	inline std::string memo_path(const PendingCmd& c, const Memo& memo)
+	{
+		/* The commands piped to it, their outputs are its input */
+		U64 hash = FNV_BASIS;
+		for(const char* arg: c.upstream_argv())
+			hash = arg ? hash_bytes(arg, strlen(arg) + 1, hash) : hash_bytes("|", 2, hash);
+
+		for(const char* const* arg = c.cmd.argv.data(); *arg; ++arg)
+			hash = hash_bytes(*arg, strlen(*arg) + 1, hash);
+
+		char cwd[4096];
+		if(getcwd(cwd, sizeof cwd))
+			hash = hash_bytes(cwd, strlen(cwd) + 1, hash);
+
+		for(const char* name: memo.envs)
+		{
+			hash = hash_bytes(name, strlen(name) + 1, hash);
+			const char* value = getenv(name);
+			hash = value ? hash_bytes(value, strlen(value) + 1, hash) : hash_bytes("\1", 1, hash);
+		}
+
+		for(const char* file: memo.files)
+		{
+			Dependency dep;
+			if(stat_dependency(file, dep))
+			{
+				I64 id[] = { dep.mtime_ns, dep.size, (I64)dep.ino };
+				hash = hash_bytes(id, sizeof id, hash);
+			}
+			hash = hash_bytes(file, strlen(file) + 1, hash);
+		}
+
+		return cache_root() + "/memo/" + to_hex(hash);
+	}
+
+	/* A result is "STATUS\n" and the output, status as returned by waitpid */
+	inline bool memo_read(const std::string& path, I64 max_age, int& status, std::string& output)
+	{
+		fd_t fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd == -1)
+			return false;
+
+		struct stat st;
+		if(fstat(fd, &st) == -1 || (max_age && time(nullptr) - st.st_mtime > max_age))
+		{
+			close(fd);
+			return false;
+		}
+
+		std::string text = read_to_end(fd);	/* closes fd */
+		size_t newline = text.find('\n');
+		if(newline == std::string::npos)
+			return false;
+
+		status = atoi(text.c_str());
+		output = text.substr(newline + 1);
+		return true;
+	}
+
+	inline void memo_write(const std::string& path, int status, const std::string& output)
+	{
+		write_atomically(path, std::to_string(status) + '\n' + output);
+	}
+
+	/* Run the command with its output captured, or take the cached result
+	 * The out of the result is a copy of where the output of the command goes,
+	 * for the caller to close, the command closes a redirected file once started */
+	inline DeadProc memoized(const PendingCmd& cc, const Memo& memo, std::string& output)
+	{
+		auto& c = const_cast<PendingCmd&>(cc);
+		const std::string path = memo_path(c, memo);
+		const fd_t out = fcntl(c.out, F_DUPFD_CLOEXEC, 3);
+
+		int status;
+		if(memo_read(path, memo.max_age, status, output))
+		{
+			if(tracing())
+			{
+				TraceArgs args;
+				trace_event("memo", 'i', now_us(), &args.add("argv", c.cmd.argv.data()).add("status", status));
+			}
+			c.cancel();
+			return DeadProc(Proc{ 0, c.in, out, c.err }, status);
+		}
+
+		/* Capture the output wherever it was going */
+		const fd_t redirected = c.out;
+		c.out = 1;
+		Proc p = detachRedirOut(c);
+		c.out = redirected;
+		output = read_to_end(p.out);
+		DeadProc dead = wait(p);
+
+		/* A killed command tells nothing about its input */
+		if(dead.normal_exit)
+			memo_write(path, dead.exit_status << 8, output);	/* like waitpid */
+		dead.out = out;
+		return dead;
+	}
+}
+
+inline std::string memo$(const PendingCmd& c, const Memo& memo)
+{
+	std::string output;
+	close(_cppipe::memoized(c, memo, output).out);
+
+	// Remove trailing newlines like $()
+	size_t end = output.find_last_not_of('\n');
+	output.erase(end == std::string::npos ? 0 : end + 1);
+	return output;
+}
+
+inline DeadProc memo_run(const PendingCmd& c, const Memo& memo)
+{
+	std::string output;
+	DeadProc dead = _cppipe::memoized(c, memo, output);
+
+	for(size_t done = 0; done < output.size(); )
+	{
+		ssize_t n = write(dead.out, output.data() + done, output.size() - done);
+		if(n <= 0)
+			break;
+		done += n;
+	}
+	close(dead.out);
+	dead.out = c.out;
+	return dead;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include "basicTypes.h"
+
+/* Shared memory rings between cppipe programs
+
+   A pipe copies every byte twice and holds 64 KiB, a ring is a memfd mapped
+   by both processes, the writer copies into it and the reader out of it.
+
+   A command with ring() is offered a ring with each pipe createProcess makes
+   for its stdin or stdout, and operator| passes the ring of the stdout of a
+   command on to the next one. The ring is only used if the other side reads
+   or writes through a RingReader or RingWriter, anything else simply uses
+   the pipe, so a ring() command can be piped to any program.
+
+   script:
+       Proc gen = detachRedirOut(Cmd("./generate.cpp").ring());
+       RingReader records(gen);
+   generate.cpp:
+       RingWriter out;
+       out.write(&record, sizeof record);
+
+   Handshake: the reader accepts the ring with a CAS, while it has not the
+   writer writes to the pipe, after it notices it records how much it wrote
+   there and writes one more byte as a mark, the reader reads that much from
+   the pipe, drops the mark and switches to the ring.
+   A writer that finishes first declines the ring with a CAS.
+
+   Each side checks an empty or full ring RING_SPINS times before it sleeps
+   on a futex, so records that are written one by one don't cost a wake each.
+*/
+
+namespace _cppipe
+{
+	/* Where a child finds the rings offered with its stdin and stdout */
+	enum : fd_t { RING_IN_FD = 3, RING_OUT_FD = 4 };
+
+	/* Bytes of the data of a ring */
+	enum : U64 { RING_BYTES = 4 << 20 };
+
+	/* Checks of an empty or full ring before sleeping on its futex,
+	   the first RING_PAUSES pause the CPU, the rest yield it */
+	enum : int { RING_PAUSES = 64, RING_SPINS = 256 };
+
+	enum RingState : U32
+	{
+		RING_OFFERED,
+		RING_ACCEPTED,	/* by the reader */
+		RING_SWITCHED,	/* the writer writes to the ring from now on */
+		RING_DECLINED	/* the writer finished without switching */
+	};
+
+	/* Start of the memfd of a ring, the data follows at RING_HEADER_BYTES */
+	struct RingHeader
+	{
+		U64 magic;
+		U64 capacity;			/* a power of 2 */
+		U64 pipe_dev, pipe_ino;		/* the pipe it was offered with */
+		std::atomic<U32> state;		/* a RingState */
+		std::atomic<U32> closed;	/* the writer finished */
+		std::atomic<U64> pipe_bytes;	/* written to the pipe before switching */
+
+		alignas(64) std::atomic<U64> head;	/* bytes written, by the writer */
+		std::atomic<U32> data_seq;		/* futex the reader waits on */
+		std::atomic<U32> reader_waiting;
+		alignas(64) std::atomic<U64> tail;	/* bytes read, by the reader */
+		std::atomic<U32> space_seq;		/* futex the writer waits on */
+		std::atomic<U32> writer_waiting;
+	};
+
+	enum : U64 { RING_MAGIC = 0x676e6972'65706970ull, RING_HEADER_BYTES = 4096 };
+
+	/* A memfd of a ring offered with the pipe, -1 if it can't be made */
+	fd_t create_ring(fd_t pipe);
+
+	/* Map a ring, nullptr if fd is not one offered with the pipe */
+	RingHeader* map_ring(fd_t fd, fd_t pipe);
+
+	/* Put the rings at RING_IN_FD and RING_OUT_FD, in a child before exec
+	 * what was at the place of a ring is replaced, the other FDs are left as they are */
+	void place_rings(fd_t in_ring, fd_t out_ring);
+
+	/* Wait on a futex of a ring while it has the value, at most timeout_ms */
+	void ring_wait(std::atomic<U32>& futex, U32 value, int timeout_ms);
+	void ring_wake(std::atomic<U32>& futex);
+	/* Wait a moment before checking a ring again, spin counts the checks */
+	void ring_spin(int spin);
+}
+
+/* childProcess uses the declarations above */
+#include "childProcess.hpp"
+
+/* Reads the stdin of a cppipe program, or the output of a child,
+   through the ring offered with the pipe if there is one, else from the pipe */
+class RingReader
+{
+public:
+	/* stdin */
+	RingReader();
+	/* The out of a process from detachRedirOut, takes its out and out_ring */
+	explicit RingReader(Proc&);
+	/* pipe is closed by the reader, ring is -1 for none */
+	RingReader(fd_t pipe, fd_t ring);
+	~RingReader();
+
+	RingReader(const RingReader&) = delete;
+	RingReader& operator=(const RingReader&) = delete;
+
+	/* Read up to len bytes, wait for at least one, 0 at the end */
+	size_t read(void* buf, size_t len);
+	/* Read exactly len bytes, false if the data ends before */
+	bool read_all(void* buf, size_t len);
+	/* Whether we accepted a ring, the writer uses it from its next write */
+	bool has_ring() const;
+
+private:
+	size_t read_pipe(void* buf, size_t len);
+
+	fd_t pipe_;
+	_cppipe::RingHeader* ring_ = nullptr;
+	U64 pipe_read_ = 0;		/* bytes read from the pipe */
+	bool switched_ = false;
+};
+
+/* Writes the stdout of a cppipe program, or the input of a child,
+   through the ring offered with the pipe if the reader accepts it */
+class RingWriter
+{
+public:
+	/* stdout */
+	RingWriter();
+	/* The in of a process from detachRedirIn, takes its in and in_ring */
+	explicit RingWriter(Proc&);
+	/* pipe is closed by the writer, ring is -1 for none */
+	RingWriter(fd_t pipe, fd_t ring);
+	/* close() */
+	~RingWriter();
+
+	RingWriter(const RingWriter&) = delete;
+	RingWriter& operator=(const RingWriter&) = delete;
+
+	/* Write all of the data, false if the reader is gone */
+	bool write(const void* data, size_t len);
+	/* The reader sees the end of the data */
+	void close();
+
+private:
+	void switch_to_ring();
+
+	fd_t pipe_;
+	_cppipe::RingHeader* ring_ = nullptr;
+	U64 pipe_written_ = 0;		/* bytes written to the pipe */
+	bool switched_ = false;
+};
+
+#include "ring.inl"
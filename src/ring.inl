@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "ring.hpp"
+
+namespace _cppipe
+{
+	inline fd_t create_ring(fd_t pipe)
+	{
+		struct stat st;
+		if(fstat(pipe, &st) == -1)
+			return -1;
+
+		fd_t fd = memfd_create("cppipe_ring", MFD_CLOEXEC);
+		if(fd == -1)
+			return -1;
+		if(ftruncate(fd, RING_HEADER_BYTES + RING_BYTES) == -1)
+		{
+			close(fd);
+			return -1;
+		}
+
+		void* mem = mmap(nullptr, RING_HEADER_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(mem == MAP_FAILED)
+		{
+			close(fd);
+			return -1;
+		}
+		RingHeader* ring = new(mem) RingHeader{};
+		ring->capacity = RING_BYTES;
+		ring->pipe_dev = st.st_dev;
+		ring->pipe_ino = st.st_ino;
+		ring->state = RING_OFFERED;
+		ring->magic = RING_MAGIC;
+		munmap(mem, RING_HEADER_BYTES);
+		return fd;
+	}
+
+	inline RingHeader* map_ring(fd_t fd, fd_t pipe)
+	{
+		/* Anything else can be at the fd of a program that wasn't offered a ring */
+		struct stat st, pipe_st;
+		if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= (off_t)RING_HEADER_BYTES
+		   || fstat(pipe, &pipe_st) == -1)
+			return nullptr;
+
+		void* mem = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(mem == MAP_FAILED)
+			return nullptr;
+
+		RingHeader* ring = (RingHeader*)mem;
+		if(ring->magic != RING_MAGIC || ring->capacity + RING_HEADER_BYTES != (U64)st.st_size
+		   || ring->pipe_dev != (U64)pipe_st.st_dev || ring->pipe_ino != (U64)pipe_st.st_ino)
+		{
+			munmap(mem, st.st_size);
+			return nullptr;
+		}
+		return ring;
+	}
+
+	inline void place_rings(fd_t in_ring, fd_t out_ring)
+	{
+		/* Out of the way first, each may be at the place of the other */
+		if(in_ring != -1)
+			in_ring = fcntl(in_ring, F_DUPFD_CLOEXEC, RING_OUT_FD + 1);
+		if(out_ring != -1)
+			out_ring = fcntl(out_ring, F_DUPFD_CLOEXEC, RING_OUT_FD + 1);
+
+		/* dup2 clears O_CLOEXEC, the copies above go with the exec */
+		if(in_ring != -1)
+			dup2(in_ring, RING_IN_FD);
+		if(out_ring != -1)
+			dup2(out_ring, RING_OUT_FD);
+	}
+
+	inline void ring_wait(std::atomic<U32>& futex, U32 value, int timeout_ms)
+	{
+		timespec timeout{ timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+		syscall(SYS_futex, (U32*)&futex, FUTEX_WAIT, value, &timeout, nullptr, 0);
+	}
+
+	inline void ring_wake(std::atomic<U32>& futex)
+	{
+		++futex;
+		syscall(SYS_futex, (U32*)&futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	}
+
+	inline void ring_spin(int spin)
+	{
+		/* On another core the other side is a pause away, on ours it needs our time slice */
+		if(spin < RING_PAUSES)
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#endif
+		}
+		else
+			sched_yield();
+	}
+
+	/* Whether the other end of a pipe is closed, e.g. the process died */
+	inline bool pipe_hung_up(fd_t pipe)
+	{
+		pollfd p{ pipe, 0, 0 };
+		return poll(&p, 1, 0) == 1 && (p.revents & (POLLHUP | POLLERR));
+	}
+
+	inline void unmap_ring(RingHeader* ring)
+	{
+		munmap(ring, RING_HEADER_BYTES + ring->capacity);
+	}
+}
+
+inline RingReader::RingReader()
+	: RingReader(STDIN_FILENO, -1)
+{
+	ring_ = _cppipe::map_ring(_cppipe::RING_IN_FD, STDIN_FILENO);
+	if(!ring_)
+		return;
+	close(_cppipe::RING_IN_FD);
+
+	U32 offered = _cppipe::RING_OFFERED;
+	if(!ring_->state.compare_exchange_strong(offered, _cppipe::RING_ACCEPTED))
+	{
+		_cppipe::unmap_ring(ring_);
+		ring_ = nullptr;
+	}
+}
+
+inline RingReader::RingReader(Proc& p)
+	: RingReader(p.out, p.out_ring)
+{
+	p.out = -1;
+	p.out_ring = -1;
+}
+
+inline RingReader::RingReader(fd_t pipe, fd_t ring)
+	: pipe_(pipe)
+{
+	if(ring == -1)
+		return;
+	ring_ = _cppipe::map_ring(ring, pipe);
+	close(ring);
+
+	U32 offered = _cppipe::RING_OFFERED;
+	if(ring_ && !ring_->state.compare_exchange_strong(offered, _cppipe::RING_ACCEPTED))
+	{
+		_cppipe::unmap_ring(ring_);
+		ring_ = nullptr;
+	}
+}
+
+inline RingReader::~RingReader()
+{
+	if(ring_)
+		_cppipe::unmap_ring(ring_);
+	if(pipe_ != STDIN_FILENO)
+		close(pipe_);
+}
+
+inline size_t RingReader::read_pipe(void* buf, size_t len)
+{
+	ssize_t n;
+	while((n = ::read(pipe_, buf, len)) == -1 && errno == EINTR)
+		;
+	return n > 0 ? n : 0;
+}
+
+inline size_t RingReader::read(void* buf, size_t len)
+{
+	using namespace _cppipe;
+
+	if(!ring_ || len == 0)
+		return read_pipe(buf, len);
+
+	/* Until the writer switches, what it wrote to the pipe comes first,
+	   then the mark it writes after switching ends the wait on the pipe */
+	while(!switched_)
+	{
+		const size_t n = read_pipe(buf, len);
+		if(ring_->state != RING_SWITCHED)
+		{
+			pipe_read_ += n;
+			return n;	/* 0 at the end of the pipe, the writer declined or died */
+		}
+
+		const size_t data = std::min<U64>(n, ring_->pipe_bytes - pipe_read_);
+		pipe_read_ += data;
+		switched_ = n > data || n == 0;
+		if(data)
+			return data;
+	}
+
+	RingHeader& r = *ring_;
+	const U64 tail = r.tail.load(std::memory_order_relaxed);
+	U64 head;
+	for(int spin = 0; ; )
+	{
+		head = r.head.load(std::memory_order_acquire);
+		if(head != tail)
+			break;
+		if(r.closed)
+		{
+			head = r.head.load(std::memory_order_acquire);
+			if(head == tail)
+				return 0;
+			break;
+		}
+
+		/* A running writer is likely to write again soon, waking us costs it a syscall */
+		if(spin < RING_SPINS)
+		{
+			ring_spin(spin++);
+			continue;
+		}
+
+		/* The writer wakes us if it sees the flag after we checked the head */
+		const U32 seq = r.data_seq;
+		r.reader_waiting = 1;
+		if(r.head == tail && !r.closed)
+		{
+			ring_wait(r.data_seq, seq, 50);
+			if(r.head == tail && !r.closed && pipe_hung_up(pipe_))
+			{
+				r.reader_waiting = 0;
+				return 0;	/* the writer died */
+			}
+		}
+		r.reader_waiting = 0;
+	}
+
+	const char* data = (const char*)ring_ + RING_HEADER_BYTES;
+	const size_t n = std::min<U64>(len, head - tail);
+	const size_t offset = tail & (r.capacity - 1);
+	const size_t first = std::min<size_t>(n, r.capacity - offset);
+	memcpy(buf, data + offset, first);
+	memcpy((char*)buf + first, data, n - first);
+
+	r.tail = tail + n;
+	if(r.writer_waiting)
+		ring_wake(r.space_seq);
+	return n;
+}
+
+inline bool RingReader::read_all(void* buf, size_t len)
+{
+	for(size_t done = 0; done < len; )
+	{
+		const size_t n = read((char*)buf + done, len - done);
+		if(n == 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+inline bool RingReader::has_ring() const
+{
+	return ring_ != nullptr;
+}
+
+inline RingWriter::RingWriter()
+	: RingWriter(STDOUT_FILENO, -1)
+{
+	ring_ = _cppipe::map_ring(_cppipe::RING_OUT_FD, STDOUT_FILENO);
+	if(ring_)
+		::close(_cppipe::RING_OUT_FD);
+}
+
+inline RingWriter::RingWriter(Proc& p)
+	: RingWriter(p.in, p.in_ring)
+{
+	p.in = -1;
+	p.in_ring = -1;
+}
+
+inline RingWriter::RingWriter(fd_t pipe, fd_t ring)
+	: pipe_(pipe)
+{
+	if(ring == -1)
+		return;
+	ring_ = _cppipe::map_ring(ring, pipe);
+	::close(ring);
+}
+
+inline RingWriter::~RingWriter()
+{
+	close();
+}
+
+inline void RingWriter::switch_to_ring()
+{
+	using namespace _cppipe;
+
+	/* The reader takes this much from the pipe first, the byte after it
+	   wakes a reader that waits on the pipe */
+	ring_->pipe_bytes = pipe_written_;
+	ring_->state = RING_SWITCHED;
+	while(::write(pipe_, "", 1) == -1 && errno == EINTR)
+		;
+	switched_ = true;
+}
+
+inline bool RingWriter::write(const void* data, size_t len)
+{
+	using namespace _cppipe;
+
+	if(ring_ && !switched_ && ring_->state == RING_ACCEPTED)
+		switch_to_ring();
+
+	if(!switched_)
+	{
+		for(size_t done = 0; done < len; )
+		{
+			const ssize_t n = ::write(pipe_, (const char*)data + done, len - done);
+			if(n == -1 && errno == EINTR)
+				continue;
+			if(n == -1)
+				return false;
+			done += n;
+			pipe_written_ += n;
+		}
+		return true;
+	}
+
+	RingHeader& r = *ring_;
+	char* ring_data = (char*)ring_ + RING_HEADER_BYTES;
+	for(int spin = 0; len; )
+	{
+		const U64 head = r.head.load(std::memory_order_relaxed);
+		const U64 space = r.capacity - (head - r.tail.load(std::memory_order_acquire));
+		if(space == 0 && spin < RING_SPINS)
+		{
+			ring_spin(spin++);
+			continue;
+		}
+		if(space == 0)
+		{
+			/* The reader wakes us if it sees the flag after we checked the tail */
+			const U32 seq = r.space_seq;
+			r.writer_waiting = 1;
+			if(r.tail + r.capacity == head)
+			{
+				ring_wait(r.space_seq, seq, 50);
+				if(r.tail + r.capacity == head && pipe_hung_up(pipe_))
+				{
+					r.writer_waiting = 0;
+					return false;	/* the reader died */
+				}
+			}
+			r.writer_waiting = 0;
+			continue;
+		}
+
+		const size_t n = std::min<U64>(len, space);
+		const size_t offset = head & (r.capacity - 1);
+		const size_t first = std::min<size_t>(n, r.capacity - offset);
+		memcpy(ring_data + offset, data, first);
+		memcpy(ring_data, (const char*)data + first, n - first);
+
+		r.head = head + n;
+		if(r.reader_waiting)
+			ring_wake(r.data_seq);
+
+		data = (const char*)data + n;
+		len -= n;
+	}
+	return true;
+}
+
+inline void RingWriter::close()
+{
+	using namespace _cppipe;
+
+	if(ring_)
+	{
+		U32 offered = RING_OFFERED;
+		if(!switched_ && !ring_->state.compare_exchange_strong(offered, RING_DECLINED))
+			switch_to_ring();	/* accepted after our last write */
+		if(switched_)
+		{
+			ring_->closed = 1;
+			ring_wake(ring_->data_seq);
+		}
+		unmap_ring(ring_);
+		ring_ = nullptr;
+	}
+
+	if(pipe_ != STDOUT_FILENO && pipe_ != -1)
+		::close(pipe_);
+	pipe_ = -1;
+}
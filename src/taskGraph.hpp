@@ -0,0 +1,64 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include "commands.hpp"
+
+/* Make like parallel execution of commands
+
+   Tasks declare the files they read and write, a task runs after the tasks
+   that write its inputs, the rest run in parallel. A task whose outputs are
+   newer than its inputs is skipped, like with make.
+
+   shell:
+       cc -c a.c && cc -c b.c && cc -o prog a.o b.o
+   becomes:
+       TaskGraph g;
+       g.add(Cmd("cc", "-c", "a.c")).input("a.c").output("a.o");
+       g.add(Cmd("cc", "-c", "b.c")).input("b.c").output("b.o");
+       g.add(Cmd("cc", "-o", "prog", "a.o", "b.o")).input("a.o").input("b.o").output("prog");
+       g.run();
+
+   char* paths are kept and used NOT COPIED, they are compared as given
+*/
+
+/* A step of a TaskGraph */
+class Task
+{
+public:
+	explicit Task(Cmd);
+
+	/* A file the task reads */
+	Task& input(const char* path);
+	/* A file the task writes */
+	Task& output(const char* path);
+	/* Another command to run after the previous ones succeed */
+	Task& then(Cmd);
+	/* Write the output of the last command to a file, which is also an output */
+	Task& stdout_to(const char* path);
+	/* Up to date if the contents of the inputs are the same as when the task
+	   last ran, rather than by time stamps */
+	Task& by_hash();
+
+	std::vector<Cmd> cmds;
+	std::vector<const char*> inputs;
+	std::vector<const char*> outputs;
+	const char* stdout_file = nullptr;
+	bool compare_hash = false;
+};
+
+class TaskGraph
+{
+public:
+	/* Add a task that runs the command, set its files on the returned Task */
+	Task& add(Cmd);
+
+	/* Run the tasks that are not up to date, at most jobs at a time, 0 for one per core
+	   On the first failure no more tasks are started, the running ones are waited for,
+	   the outputs of the failed one are removed and false is returned */
+	bool run(int jobs = 0);
+
+	std::deque<Task> tasks;	/* a deque, so the Tasks returned by add stay valid */
+};
+
+#include "taskGraph.inl"
@@ -0,0 +1,270 @@
+#include <cstring>
+#include <iostream>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "taskGraph.hpp"
+#include "cache.hpp"
+
+inline Task::Task(Cmd cmd)
+	: cmds{ std::move(cmd) }
+{}
+
+inline Task& Task::input(const char* path)
+{
+	inputs.push_back(path);
+	return *this;
+}
+
+inline Task& Task::output(const char* path)
+{
+	outputs.push_back(path);
+	return *this;
+}
+
+inline Task& Task::then(Cmd cmd)
+{
+	cmds.push_back(std::move(cmd));
+	return *this;
+}
+
+inline Task& Task::stdout_to(const char* path)
+{
+	stdout_file = path;
+	return output(path);
+}
+
+inline Task& Task::by_hash()
+{
+	compare_hash = true;
+	return *this;
+}
+
+inline Task& TaskGraph::add(Cmd cmd)
+{
+	return tasks.emplace_back(std::move(cmd));
+}
+
+namespace _cppipe
+{
+	/* Where the input hash of a by_hash task is kept, found by its outputs */
+	inline std::string task_hash_path(const Task& task)
+	{
+		U64 hash = FNV_BASIS;
+		char cwd[4096];
+		if(getcwd(cwd, sizeof cwd))
+			hash = hash_bytes(cwd, strlen(cwd) + 1, hash);
+		for(const char* output: task.outputs)
+			hash = hash_bytes(output, strlen(output) + 1, hash);
+		return cache_root() + "/tasks/" + to_hex(hash);
+	}
+
+	/* Of the commands and the contents of the inputs */
+	inline std::string task_input_hash(const Task& task)
+	{
+		U64 hash = FNV_BASIS;
+		for(const Cmd& cmd: task.cmds)
+			for(const char* const* arg = cmd.argv.data(); *arg; ++arg)
+				hash = hash_bytes(*arg, strlen(*arg) + 1, hash);
+
+		for(const char* input: task.inputs)
+		{
+			fd_t fd = open(input, O_RDONLY | O_CLOEXEC);
+			if(fd == -1)
+				return "";
+			char buf[65536];
+			for(ssize_t n; (n = read(fd, buf, sizeof buf)) > 0; )
+				hash = hash_bytes(buf, n, hash);
+			close(fd);
+			hash = hash_bytes("", 1, hash);	/* separator */
+		}
+		return to_hex(hash);
+	}
+
+	inline bool task_up_to_date(const Task& task)
+	{
+		if(task.outputs.empty())
+			return false;
+
+		struct stat st;
+		timespec oldest_output{ INT64_MAX, 0 };
+		for(const char* output: task.outputs)
+		{
+			if(stat(output, &st) == -1)
+				return false;
+			if(st.st_mtim.tv_sec < oldest_output.tv_sec
+			   || (st.st_mtim.tv_sec == oldest_output.tv_sec && st.st_mtim.tv_nsec < oldest_output.tv_nsec))
+				oldest_output = st.st_mtim;
+		}
+
+		if(task.compare_hash)
+		{
+			fd_t fd = open(task_hash_path(task).c_str(), O_RDONLY | O_CLOEXEC);
+			if(fd == -1)
+				return false;
+			std::string hash = read_to_end(fd);	/* closes fd */
+			return !hash.empty() && hash == task_input_hash(task);
+		}
+
+		for(const char* input: task.inputs)
+		{
+			if(stat(input, &st) == -1
+			   || st.st_mtim.tv_sec > oldest_output.tv_sec
+			   || (st.st_mtim.tv_sec == oldest_output.tv_sec && st.st_mtim.tv_nsec > oldest_output.tv_nsec))
+				return false;
+		}
+		return true;
+	}
+
+	inline void no_op_handler(int)
+	{}
+}
+
+inline bool TaskGraph::run(int jobs)
+{
+	using namespace _cppipe;
+
+	if(jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if(jobs <= 0)
+		jobs = 1;
+
+	/* A task waits for the tasks that write its inputs */
+	const size_t count = tasks.size();
+	std::vector<std::vector<size_t>> dependents(count);
+	std::vector<size_t> waiting_for(count, 0);
+	for(size_t t = 0; t < count; ++t)
+		for(const char* input: tasks[t].inputs)
+			for(size_t producer = 0; producer < count; ++producer)
+				for(const char* output: tasks[producer].outputs)
+					if(producer != t && !strcmp(input, output))
+					{
+						dependents[producer].push_back(t);
+						++waiting_for[t];
+					}
+
+	std::deque<size_t> ready;
+	for(size_t t = 0; t < count; ++t)
+		if(!waiting_for[t])
+			ready.push_back(t);
+
+	struct Running
+	{
+		size_t task;
+		size_t cmd;	/* index in Task::cmds */
+		Proc proc;
+	};
+	std::vector<Running> running;
+	size_t finished = 0;
+	bool failed = false;
+
+	auto finish = [&](size_t t)
+	{
+		++finished;
+		for(size_t dependent: dependents[t])
+			if(--waiting_for[dependent] == 0)
+				ready.push_back(dependent);
+	};
+
+	auto fail = [&](size_t t)
+	{
+		std::cerr << "Task failed: " << tasks[t].cmds[0] << '\n';
+		for(const char* output: tasks[t].outputs)
+			unlink(output);
+		failed = true;
+	};
+
+	sigset_t sigchld, old_mask;
+	sigemptyset(&sigchld);
+	sigaddset(&sigchld, SIGCHLD);
+
+	auto start = [&](size_t t, size_t c)
+	{
+		const Task& task = tasks[t];
+		const Cmd& cmd = task.cmds[c];
+
+		fd_t out = 1;
+		if(task.stdout_file && c + 1 == task.cmds.size())
+		{
+			out = open(task.stdout_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if(out == -1)
+			{
+				std::cerr << "Can't open: " << task.stdout_file << ' ' << strerror(errno) << '\n';
+				fail(t);
+				return;
+			}
+		}
+
+		/* The command gets the mask of the script, a child that exits meanwhile
+		   is found by the checks, which always follow a start */
+		sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+		running.push_back({ t, c, createProcess(cmd.argv.data(), 0, out, 2, &cmd.attrs) });
+		sigprocmask(SIG_BLOCK, &sigchld, nullptr);
+		if(out != 1)
+			close(out);
+	};
+
+	/* Sleep until a child exits, SIGCHLD stays blocked between the checks so it isn't missed,
+	   the processes are waited by pid, the other children of the script are left alone */
+	sigprocmask(SIG_BLOCK, &sigchld, &old_mask);
+	struct sigaction wake{}, old_action;
+	wake.sa_handler = no_op_handler;
+	sigaction(SIGCHLD, &wake, &old_action);
+
+	for(;;)
+	{
+		while(!failed && !ready.empty() && running.size() < (size_t)jobs)
+		{
+			size_t t = ready.front();
+			ready.pop_front();
+			if(task_up_to_date(tasks[t]))
+				finish(t);
+			else
+				start(t, 0);
+		}
+
+		if(running.empty())
+			break;
+
+		bool exited = false;
+		for(size_t r = 0; r < running.size(); )
+		{
+			std::optional<DeadProc> dead = check_exited(running[r].proc);
+			if(!dead)
+			{
+				++r;
+				continue;
+			}
+			exited = true;
+
+			const Running done = running[r];
+			running.erase(running.begin() + r);
+			const Task& task = tasks[done.task];
+
+			if(!bool(*dead))
+				fail(done.task);
+			else if(done.cmd + 1 < task.cmds.size())
+				start(done.task, done.cmd + 1);
+			else
+			{
+				if(task.compare_hash)
+					write_atomically(task_hash_path(task), task_input_hash(task));
+				finish(done.task);
+			}
+		}
+
+		if(!exited)
+			sigsuspend(&old_mask);
+	}
+
+	sigaction(SIGCHLD, &old_action, nullptr);
+	sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+
+	if(!failed && finished < count)
+	{
+		std::cerr << "Tasks depend on each other in a cycle\n";
+		return false;
+	}
+	return !failed;
+}
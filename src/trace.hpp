@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include "basicTypes.h"
+
+/* Tracing of spawned commands, pipes and redirections
+
+   If the CPPIPE_TRACE environment variable is set to a file path, events are
+   appended to that file in the Chrome trace JSON format, it can be opened with
+   chrome://tracing or https://ui.perfetto.dev
+
+   All processes share the file, so a cppipe script and the cppipe scripts it
+   runs end up on the same timeline. When CPPIPE_TRACE is not set, tracing
+   costs a single branch per event.
+*/
+
+namespace _cppipe
+{
+	/* Whether CPPIPE_TRACE is set, only checked on the first call */
+	bool tracing();
+
+	/* Microseconds on the monotonic clock, shared by all processes */
+	I64 now_us();
+
+	/* Build the JSON "args" of an event */
+	class TraceArgs
+	{
+	public:
+		TraceArgs& add(const char* key, I64 value);
+		TraceArgs& add(const char* key, const char* value);
+		/* null terminated list of strings, e.g. argv */
+		TraceArgs& add(const char* key, const char* const list[]);
+
+		std::string json;
+	};
+
+	/* ph is the Chrome trace event phase:
+	   'X' complete, 'i' instant, 'b'/'e' async begin/end with the given id */
+	void trace_event(const char* name, char ph, I64 ts, const TraceArgs* args = nullptr,
+	                 I64 id = 0, I64 dur = 0);
+
+	/* Emit a complete event covering the lifetime of the object */
+	class TraceSpan
+	{
+	public:
+		explicit TraceSpan(const char* name);
+		~TraceSpan();
+
+		TraceSpan(const TraceSpan&) = delete;
+		TraceSpan& operator=(const TraceSpan&) = delete;
+
+		/* Emit the event now instead of on destruction,
+		 * e.g. before an exec that never returns to the destructor */
+		void end();
+
+		/* Extra args to attach to the event */
+		TraceArgs args;
+	private:
+		const char* name_;
+		I64 begin_;
+	};
+}
+
+#include "trace.inl"
@@ -0,0 +1,139 @@
+#include <cstdlib>
+#include <cstdio>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.hpp"
+
+namespace _cppipe
+{
+	/* -2 until tracing() is first called, -1 if tracing is off */
+	inline fd_t trace_fd_ = -2;
+
+	inline bool tracing()
+	{
+		if(trace_fd_ != -2)
+			return trace_fd_ != -1;
+
+		trace_fd_ = -1;
+		const char* file = getenv("CPPIPE_TRACE");
+		if(!file || !*file)
+			return false;
+
+		/* The first process to create the file opens the JSON array,
+		   the closing ] is optional in the Chrome trace format */
+		trace_fd_ = open(file, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if(trace_fd_ != -1)
+			write(trace_fd_, "[\n", 2);
+		else
+			trace_fd_ = open(file, O_WRONLY | O_APPEND | O_CLOEXEC);
+
+		return trace_fd_ != -1;
+	}
+
+	inline I64 now_us()
+	{
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return (I64)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+	}
+
+	inline void append_json_string(std::string& out, const char* s)
+	{
+		out += '"';
+		for(; *s; ++s)
+		{
+			unsigned char c = *s;
+			if(c == '"' || c == '\\')
+			{
+				out += '\\';
+				out += c;
+			}
+			else if(c < 0x20)
+			{
+				char esc[8];
+				snprintf(esc, sizeof esc, "\\u%04x", c);
+				out += esc;
+			}
+			else
+				out += c;
+		}
+		out += '"';
+	}
+
+	inline TraceArgs& TraceArgs::add(const char* key, I64 value)
+	{
+		json += json.empty() ? '{' : ',';
+		append_json_string(json, key);
+		json += ':';
+		json += std::to_string(value);
+		return *this;
+	}
+
+	inline TraceArgs& TraceArgs::add(const char* key, const char* value)
+	{
+		json += json.empty() ? '{' : ',';
+		append_json_string(json, key);
+		json += ':';
+		append_json_string(json, value);
+		return *this;
+	}
+
+	inline TraceArgs& TraceArgs::add(const char* key, const char* const list[])
+	{
+		json += json.empty() ? '{' : ',';
+		append_json_string(json, key);
+		json += ":[";
+		for(const char* const* s = list; *s; ++s)
+		{
+			if(s != list)
+				json += ',';
+			append_json_string(json, *s);
+		}
+		json += ']';
+		return *this;
+	}
+
+	inline void trace_event(const char* name, char ph, I64 ts, const TraceArgs* args, I64 id, I64 dur)
+	{
+		if(!tracing())
+			return;
+
+		std::string e = "{\"name\":";
+		append_json_string(e, name);
+		e += ",\"cat\":\"cppipe\",\"ph\":\"";
+		e += ph;
+		e += "\",\"ts\":" + std::to_string(ts);
+		if(ph == 'X')
+			e += ",\"dur\":" + std::to_string(dur);
+		if(ph == 'b' || ph == 'e')
+			e += ",\"id\":" + std::to_string(id);
+
+		std::string pid = std::to_string(getpid());
+		e += ",\"pid\":" + pid + ",\"tid\":" + pid;
+
+		if(args && !args->json.empty())
+			e += ",\"args\":" + args->json + '}';
+		e += "},\n";
+
+		/* A single append keeps events from different processes whole */
+		write(trace_fd_, e.data(), e.size());
+	}
+
+	inline TraceSpan::TraceSpan(const char* name)
+		: name_(name)
+		, begin_(tracing() ? now_us() : 0)
+	{}
+
+	inline TraceSpan::~TraceSpan()
+	{
+		end();
+	}
+
+	inline void TraceSpan::end()
+	{
+		if(tracing() && name_)
+			trace_event(name_, 'X', begin_, &args, 0, now_us() - begin_);
+		name_ = nullptr;
+	}
+}
@@ -5,4 +5,149 @@ export CPPIPEPATH="/:test::/usr"
 
 cppipe c_file.c > /dev/null
 
+# Trace the commands cppipe runs, on a fresh copy so it gets compiled
+tmp=$(mktemp -d)
+cp test/c_file.c "$tmp"
+CPPIPE_TRACE="$tmp/trace.json" cppipe "$tmp/c_file.c" > /dev/null
+grep -q '"ph":"b"' "$tmp/trace.json"
+grep -q '"name":"compile"' "$tmp/trace.json"
+
+# Statistics are printed to stderr
+cppipe --stats test/c_file.c 2>&1 >/dev/null | grep -q "runs recorded"
+
+# A second run uses the cache index
+cppipe --stats "$tmp/c_file.c" 2>&1 >/dev/null | grep -q "cppipe: hit"
+CPPIPE_TRACE="$tmp/hit.json" cppipe "$tmp/c_file.c" > /dev/null
+grep -q '"name":"lookup"' "$tmp/hit.json"
+
+# Concurrent launches of a new script compile it once, the others wait and reuse it
+mkdir "$tmp/flight"
+cp test/c_file.c "$tmp/flight.c"
+for run in $(seq 20)
+do
+    XDG_CACHE_HOME="$tmp/flight" CPPIPE_STATS=1 cppipe "$tmp/flight.c" > /dev/null &
+done
+wait
+grep -qx "runs_compile 1" "$tmp/flight/cppipe/.stats"
+grep -qx "runs_hit 19" "$tmp/flight/cppipe/.stats"
+
+# A tiered run starts with a quick build, the optimized one replaces it in the background
+cp test/c_file.c "$tmp/tiered.c"
+cppipe -t "$tmp/tiered.c" | grep -q "C compilation: OK!"
+stamp=$(find "${XDG_CACHE_HOME:-$HOME/.cache}/cppipe" -path "*$tmp/tiered.c.stamp")
+for wait in $(seq 300)
+do
+    grep -q "^tier 1" "$stamp" && break
+    sleep 0.1
+done
+grep -q "^tier 1" "$stamp"
+cppipe -t "$tmp/tiered.c" | grep -q "C compilation: OK!"
+
+# A watched source is compiled again after it is saved, the next run is a hit
+cp test/c_file.c "$tmp/watched.c"
+cppipe --watch "$tmp/watched.c" > "$tmp/watch.log" &
+watcher=$!
+for wait in $(seq 300)
+do
+    grep -q "^Watching 1 sources" "$tmp/watch.log" && break
+    sleep 0.1
+done
+sed -i 's/OK!/watched/' "$tmp/watched.c"
+for wait in $(seq 300)
+do
+    [ "$(grep -c "^Compiled $tmp/watched.c" "$tmp/watch.log")" = 2 ] && break
+    sleep 0.1
+done
+kill $watcher
+[ "$(grep -c "^Compiled $tmp/watched.c" "$tmp/watch.log")" = 2 ]
+cppipe --stats "$tmp/watched.c" 2>&1 | grep -q "cppipe: hit"
+[ "$(cppipe "$tmp/watched.c")" = "C compilation: watched" ]
+
+# Benchmarks print a table for each build, the output of the program is discarded
+cppipe --bench 3 test/c_file.c > "$tmp/bench.txt"
+grep -q "(flags: default), 3 runs" "$tmp/bench.txt"
+grep -q "^wall ms" "$tmp/bench.txt"
+if grep -q "C compilation" "$tmp/bench.txt"
+then
+    exit 1
+fi
+cppipe --bench 3 --warmup 0 -O1 --vs -O2 test/c_file.c > "$tmp/bench.txt"
+grep -q "(flags: -O2), 3 runs" "$tmp/bench.txt"
+grep -q "^median wall time of the first is" "$tmp/bench.txt"
+
+# A standalone binary carries its manifest
+cppipe --export "$tmp/exported" test/c_file.c > /dev/null
+"$tmp/exported" > /dev/null
+grep -q "source_hash" "$tmp/exported"
+
+# Options of --export in any order, and never without it
+cppipe --march=x86-64 --export "$tmp/exported" test/c_file.c > /dev/null
+grep -q "flags .*-march=x86-64" "$tmp/exported"
+if cppipe --march=x86-64 test/c_file.c 2> /dev/null
+then
+    exit 1
+fi
+
+# Compile a directory of scripts
+cppipe --prewarm test | grep -q "Prewarmed 1 sources: .* 0 failed"
+
+# Sources given by a directive are compiled to objects and linked
+echo 'int helper(void) { return 1; }' > "$tmp/helper.c"
+printf '// cppipe: sources=helper.c\n#include <stdio.h>\nint helper(void);\nint main(void) { printf("%%d\\n", helper()); }\n' > "$tmp/main.c"
+[ "$(cppipe "$tmp/main.c")" = 1 ]
+sleep 0.01
+echo 'int helper(void) { return 2; }' > "$tmp/helper.c"
+[ "$(cppipe "$tmp/main.c")" = 2 ]
+
+# The profile guided build in the background links the objects of the directives too
+cp "$tmp/main.c" "$tmp/pgo.c"
+for run in $(seq 12)
+do
+    [ "$(cppipe --pgo "$tmp/pgo.c")" = 2 ]
+done
+stamp=$(find "${XDG_CACHE_HOME:-$HOME/.cache}/cppipe" -path "*$tmp/pgo.c.stamp")
+for wait in $(seq 300)
+do
+    grep -q "^tier 3" "$stamp" && break
+    sleep 0.1
+done
+grep -q "^tier 3" "$stamp"
+[ "$(cppipe --pgo "$tmp/pgo.c")" = 2 ]
+
+# A script called in-process with its own argv and stdout, rebuilt when it changes
+printf '#include <stdio.h>\nint main(int argc, char** argv) { printf("%%s\\n", argv[argc - 1]); return 7; }\n' > "$tmp/callee.c"
+printf '#include <cppipe/call.hpp>\n#include <iostream>\nint main() { std::cout << call("callee.c", { "called" }) << std::endl; }\n' > "$tmp/caller.cpp"
+[ "$(cd "$tmp" && cppipe caller.cpp | tr '\n' ' ')" = "called 7 " ]
+sleep 0.01
+sed -i 's/return 7/return 8/' "$tmp/callee.c"
+[ "$(cd "$tmp" && cppipe caller.cpp | tr '\n' ' ')" = "called 8 " ]
+
+# A C++ script with unique symbols, which dlclose can't unload, is loaded again after it changes
+printf 'inline int calls = 0;\nint main() { ++calls; return 7; }\n' > "$tmp/unique.cpp"
+printf '#include <cppipe/call.hpp>\n#include <iostream>\nint main() { std::cout << call("unique.cpp") << std::endl; system("sed -i s/7/8/ unique.cpp"); std::cout << call("unique.cpp") << std::endl; }\n' > "$tmp/reloader.cpp"
+[ "$(cd "$tmp" && cppipe reloader.cpp | tr '\n' ' ')" = "7 8 " ]
+
+# Quoted includes are searched in the working directory, the same script run elsewhere
+# must not run the binary built with the other header
+mkdir "$tmp/d1" "$tmp/d2"
+echo '#define WHERE 1' > "$tmp/d1/where.h"
+echo '#define WHERE 2' > "$tmp/d2/where.h"
+printf '#include "where.h"\n#include <stdio.h>\nint main(void) { printf("%%d\\n", WHERE); }\n' > "$tmp/where.c"
+[ "$(cd "$tmp/d1" && cppipe "$tmp/where.c")" = 1 ]
+[ "$(cd "$tmp/d2" && cppipe "$tmp/where.c")" = 2 ]
+[ "$(cd "$tmp/d1" && cppipe "$tmp/where.c")" = 1 ]
+
+# Temporary files of a live build are kept by the collection, the ones of a dead one removed
+cache="${XDG_CACHE_HOME:-$HOME/.cache}/cppipe"
+mkdir -p "$cache/gc"
+touch -d "10 days ago" "$cache/gc/live.tmp$$" "$cache/gc/dead.tmp99999999" "$cache/gc/live.build-$$.ii"
+CPPIPE_CACHE_MAX_AGE=1 cppipe --gc > /dev/null
+[ -e "$cache/gc/live.tmp$$" ] && [ -e "$cache/gc/live.build-$$.ii" ] && [ ! -e "$cache/gc/dead.tmp99999999" ]
+rm -r "$cache/gc"
+
+# The cache entry of a deleted source is the first to go
+rm "$tmp/c_file.c"
+cppipe --gc | grep -q "of deleted sources"
+rm -r "$tmp"
+
 echo Command line test: OK!